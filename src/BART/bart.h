@@ -40,10 +40,11 @@
 
 class bart {
 public:
-   bart():m(200),t(m),pi(),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false) {};
-   bart(size_t im):m(im),t(m),pi(),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false) {};
-   bart(const bart& ib):m(ib.m),t(m),pi(ib.pi),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false)
+   bart():m(200),t(m),pi(),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false),xbwide(false),nthreads(1),single(false) {usepool();};
+   bart(size_t im):m(im),t(m),pi(),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false),xbwide(false),nthreads(1),single(false) {usepool();};
+   bart(const bart& ib):m(ib.m),t(m),pi(ib.pi),p(0),n(0),x(0),y(0),xi(),allfit(0),r(0),ftemp(0),di(),dartOn(false),aug(false),xbwide(false),nthreads(ib.nthreads),single(ib.single)
    {
+     usepool();
      this->t = ib.t;
    };
    ~bart(){
@@ -57,7 +58,9 @@ public:
      if(&rhs != this) {
      
      this->t = rhs.t;
+     usepool();
      this->m = t.size();
+     tcut.clear();
      
      this->pi = rhs.pi;
      
@@ -67,6 +70,7 @@ public:
      if(allfit) {delete[] allfit; allfit=0;}
      if(r) {delete[] r; r=0;}
      if(ftemp) {delete[] ftemp; ftemp=0;}
+     r32.clear(); ftemp32.clear();
      
    }
    return *this;};
@@ -75,7 +79,9 @@ public:
    size_t getm() {return m;}
    void setm(size_t m) {{
      t.resize(m);
+     usepool();
      this->m = t.size();
+     tcut.clear();
      
      if(allfit && (xi.size()==p)) predict(p,n,x,allfit);
      }};
@@ -106,20 +112,20 @@ public:
    
 
    void setdata(size_t p, size_t n, double *x, double *y, int* nc){
+     if(p!=this->p || xi.size()==0) tcut.clear();
      this->p=p; this->n=n; this->x=x; this->y=y;
      if(xi.size()==0) makexinfo_bart(p,n,&x[0],xi,nc);
+     binx_bart();
      
      if(allfit) delete[] allfit;
      allfit = new double[n];
-     predict(p,n,x,allfit);
+     if(xbwide) fitbins_bart(&xb16[0],allfit);
+     else fitbins_bart(&xb8[0],allfit);
      
-     if(r) delete[] r;
-     r = new double[n];
-     
-     if(ftemp) delete[] ftemp;
-     ftemp = new double[n];
+     setbuf_bart();
      
-     di.n=n; di.p=p; di.x = &x[0]; di.y=r;
+     di.n=n; di.p=p; di.x = &x[0];
+     pvtab.clear();
      if(nv.size() > 0){
        //cout << "nv:"<<nv[0] << std::endl;
        //cout << "pv:"<<pv[0] << std::endl;
@@ -140,6 +146,57 @@ public:
      this->setdata(p, n, x, y, nc);
      delete [] nc;
    }
+   //the residuals r and the fit ftemp of the tree being drawn, in double or
+   //with single in float (r32, ftemp32); allfit and all sums stay double
+   void setbuf_bart()
+   {
+     if(r) {delete[] r; r=0;}
+     if(ftemp) {delete[] ftemp; ftemp=0;}
+     if(single) {
+       r32.resize(n);
+       ftemp32.resize(n);
+     } else {
+       std::vector<float>().swap(r32);
+       std::vector<float>().swap(ftemp32);
+       r = new double[n];
+       ftemp = new double[n];
+     }
+     di.y=r;
+   }
+   //bin of x among the cutpoints of v, the number of cutpoints <= x
+   size_t getbin(size_t v, double x) {
+     return std::upper_bound(xi[v].begin(),xi[v].end(),x) - xi[v].begin();
+   }
+   //bin the data once per setdata, 8 bits are enough unless a variable
+   //has more than 255 cutpoints
+   void binx_bart()
+   {
+     xbwide=false;
+     for(size_t v=0;v<p;v++) if(xi[v].size()>255) xbwide=true;
+     if(xbwide) {xb8.clear(); xb16.resize(n*p);}
+     else {xb16.clear(); xb8.resize(n*p);}
+     long nbk = nrowblocks(n);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) if(nbk>1)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t hi = (bk+1)*rowblock < n ? (bk+1)*rowblock : n;
+       for(size_t i=bk*rowblock*p;i<hi*p;i++) {
+         if(xbwide) xb16[i] = getbin(i%p,x[i]);
+         else xb8[i] = getbin(i%p,x[i]);
+       }
+     }
+   }
+   template<class B> void fitbins_bart(const B *xb, double *fv)
+   {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, rowblock) if(n>rowblock)
+#endif
+     for(long i=0;i<(long)n;i++) {
+       fv[i]=0.0;
+       for(size_t j=0;j<m;j++) fv[i] += t[j].bnb(xb+i*p)->gettheta();
+     }
+   }
    void setpi(pinfo& pi) {this->pi = pi;}
    void setprior(double alpha, double beta, double tau)
       {pi.alpha=alpha; pi.mybeta = beta; pi.tau=tau;}
@@ -161,6 +218,7 @@ public:
    tree& gettree(size_t i ) { return t[i];}
    xinfo& getxinfo() {return xi;}
    void setxinfo(xinfo& _xi){
+     tcut.clear();
      size_t p=_xi.size();
      xi.resize(p);
      for(size_t i=0;i<p;i++) {
@@ -170,16 +228,23 @@ public:
      }
    };
    std::vector<size_t>& getnv() {return nv;}
-   std::vector<double>& getpv() {return pv;}
+   std::vector<double>& getpv() {pvtab.clear(); return pv;} //pv may be changed
    double gettheta() {return theta;}
    //------------------------------
    //public methods
    void birth(size_t i, size_t nid,size_t v, size_t c, double ml, double mr)
-         {t[i].birth(nid,v,c,ml,mr);}
+         {tcut.clear(); t[i].birth(nid,v,c,ml,mr);}
    void death(size_t i,size_t nid, double mu)
-         {t[i].death(nid,mu);}
+         {tcut.clear(); t[i].death(nid,mu);}
    void pr();
-   void tonull() {for(size_t i=0;i!=t.size();i++) t[i].tonull();}
+   void tonull() {tcut.clear(); for(size_t i=0;i!=t.size();i++) t[i].tonull();}
+   //nodes of all the trees from this bart's pool
+   void usepool() {for(size_t i=0;i!=t.size();i++) t[i].setpool(&pool);}
+   //threads for the loops over the rows in setdata() and draw()
+   void setnthreads(int nt) {nthreads = nt<1 ? 1 : nt;}
+   //float storage of the residuals and of the fit of one tree, half the
+   //memory traffic of a draw for large n
+   void setsingle(bool s) {if(s!=single) {single=s; if(allfit) setbuf_bart();}}
    
    void fit2(tree& t, xinfo& xi, size_t p, size_t n, double *x,  double* fv)
    {
@@ -207,6 +272,8 @@ public:
    
    bool cansplit_bart(tree::tree_p n, xinfo& xi)
    {
+     std::map<tree::tree_cp,cutrange>::iterator it = bcut.find(n);
+     if(it!=bcut.end()) return it->second.ngood>0;
      int L,U;
      bool v_found = false; //have you found a variable you can split on
      size_t v=0;
@@ -221,10 +288,6 @@ public:
    
    void allsuff_bart(tree& x, xinfo& xi, dinfo& di, tree::npv& bnv, std::vector<size_t>& nv, std::vector<double>& syv)
    {
-     tree::tree_cp tbn; //the pointer to the bottom node for the current observations
-     size_t ni;         //the  index into vector of the current bottom node
-     double *xx;        //current x
-     
      bnv.clear();
      x.getbots(bnv);
      
@@ -233,19 +296,210 @@ public:
      nv.resize(nb);
      syv.resize(nb);
      
+     //the rows of each bottom node are known from setbots_bart
+     for(bvsz i=0;i!=nb;i++) {
+       std::pair<size_t,size_t>& rg = brange[bnv[i]];
+       nv[i] = rg.second-rg.first;
+       syv[i] = sumy_bart(di,rg.first,rg.second);
+     }
+   }
+   
+   //sum of y over the rows bobs[first..last), block by block
+   double sumy_bart(dinfo& di, size_t first, size_t last)
+   {
+     return single ? sumy_bart(r32.data(),first,last) : sumy_bart(di.y,first,last);
+   }
+   template<class F> double sumy_bart(const F* ry, size_t first, size_t last)
+   {
+     double sy=0.0;
+     if(last-first<=rowblock) {
+       for(size_t k=first;k<last;k++) sy += ry[bobs[k]];
+       return sy;
+     }
+     long nbk = nrowblocks(last-first);
+     std::vector<double> bsy(nbk,0.0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t lo = first+bk*rowblock, hi = lo+rowblock < last ? lo+rowblock : last;
+       double s=0.0;
+       for(size_t k=lo;k<hi;k++) s += ry[bobs[k]];
+       bsy[bk] = s;
+     }
+     for(long bk=0;bk<nbk;bk++) sy += bsy[bk];
+     return sy;
+   }
+   
+   //group the rows by their bottom node in x, the only pass of the data
+   //through x while x is drawn; bobs[brange[nd].first..brange[nd].second)
+   //are the rows of bottom node nd, the nodes are laid out left to right
+   void setbots_bart(tree& x, xinfo& xi, dinfo& di)
+   {
+     tree::npv bnv;
+     x.getbots(bnv);
+     size_t nb = bnv.size();
+     
      std::map<tree::tree_cp,size_t> bnmap;
-     for(bvsz i=0;i!=bnv.size();i++) {bnmap[bnv[i]]=i;nv[i]=0;syv[i]=0.0;}
+     for(size_t i=0;i<nb;i++) bnmap[bnv[i]]=i;
      
-     for(size_t i=0;i<di.n;i++) {
-       xx = di.x + i*di.p;
-       tbn = x.bn(xx,xi);
-       ni = bnmap[tbn];
-       
-       ++(nv[ni]);
-       syv[ni] += di.y[i];
+     //counting sort of the rows by node, counted per block of rows so that
+     //the blocks can be placed in parallel, in the same order as serially
+     long nbk = nrowblocks(di.n);
+     std::vector<size_t> cnt(nbk*nb,0); //rows of node k in block bk at [bk*nb+k]
+     bid.resize(di.n);
+     bobs.resize(di.n);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) if(nbk>1)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t hi = (bk+1)*rowblock < di.n ? (bk+1)*rowblock : di.n;
+       for(size_t i=bk*rowblock;i<hi;i++) {
+         tree::tree_cp bn = xbwide ? x.bnb(&xb16[i*di.p]) : x.bnb(&xb8[i*di.p]);
+         bid[i] = bnmap.find(bn)->second;
+         ++cnt[bk*nb+bid[i]];
+       }
+     }
+     brange.clear();
+     size_t first=0;
+     for(size_t k=0;k<nb;k++) {
+       size_t start=first;
+       for(long bk=0;bk<nbk;bk++) {
+         size_t c=cnt[bk*nb+k];
+         cnt[bk*nb+k]=first;
+         first+=c;
+       }
+       brange[bnv[k]] = std::make_pair(start,first);
+     }
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static) if(nbk>1)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t hi = (bk+1)*rowblock < di.n ? (bk+1)*rowblock : di.n;
+       for(size_t i=bk*rowblock;i<hi;i++) bobs[cnt[bk*nb+bid[i]]++] = i;
+     }
+     
+     if(bcut.empty()) {
+       std::vector<int> lu(2*p);
+       for(size_t v=0;v<p;v++) {lu[2*v]=0; lu[2*v+1]=(int)xi[v].size()-1;}
+       setcuts_bart(&x,lu);
      }
    }
    
+   //[L,U] of the cutpoints of v left to the bottom node n, from the cache of
+   //setbots_bart or else by walking up the tree
+   void getrg_bart(tree::tree_p n, size_t v, int& L, int& U)
+   {
+     std::map<tree::tree_cp,cutrange>::iterator it = bcut.find(n);
+     if(it!=bcut.end()) {
+       L = it->second.lu[2*v];
+       U = it->second.lu[2*v+1];
+     } else {
+       L=0; U = xi[v].size()-1;
+       n->rg(v,&L,&U);
+     }
+   }
+   
+   //cut ranges of the bottom nodes below n, whose ranges are in lu
+   void setcuts_bart(tree::tree_p n, std::vector<int>& lu)
+   {
+     if(!n->getl()) {
+       cutrange& cr = bcut[n];
+       cr.lu = lu;
+       cr.ngood = 0;
+       for(size_t v=0;v<p;v++) if(lu[2*v+1]>=lu[2*v]) cr.ngood++;
+       return;
+     }
+     size_t v = n->getv();
+     int c = n->getc();
+     int L = lu[2*v], U = lu[2*v+1];
+     if(c<=U) lu[2*v+1] = c-1;
+     setcuts_bart(n->getl(),lu);
+     lu[2*v+1] = U;
+     if(c>=L) lu[2*v] = c+1;
+     setcuts_bart(n->getr(),lu);
+     lu[2*v] = L;
+   }
+   
+   //fit of the tree given to setbots_bart
+   template<class F> void fitbots_bart(F* fv)
+   {
+     std::map<tree::tree_cp,std::pair<size_t,size_t> >::iterator it;
+     if(nthreads==1 || di.n<=rowblock) {
+       for(it=brange.begin();it!=brange.end();it++) {
+         double theta = it->first->gettheta();
+         for(size_t k=it->second.first;k<it->second.second;k++) fv[bobs[k]] = theta;
+       }
+       return;
+     }
+     //the ranges of the bottom nodes tile [0,n), block bk fills its part
+     std::vector<std::pair<std::pair<size_t,size_t>,double> > st; //rows and theta by node
+     for(it=brange.begin();it!=brange.end();it++)
+       st.push_back(std::make_pair(it->second,it->first->gettheta()));
+     std::sort(st.begin(),st.end());
+     long nbk = nrowblocks(di.n);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t lo = bk*rowblock, hi = lo+rowblock < di.n ? lo+rowblock : di.n;
+       for(size_t j=0;j<st.size() && st[j].first.first<hi;j++) {
+         size_t a = st[j].first.first > lo ? st[j].first.first : lo;
+         size_t b = st[j].first.second < hi ? st[j].first.second : hi;
+         for(size_t k=a;k<b;k++) fv[bobs[k]] = st[j].second;
+       }
+     }
+   }
+   
+   //nx has just been given children, split its rows between them
+   void birthbots_bart(tree::tree_p nx, xinfo& xi, dinfo& di)
+   {
+     std::pair<size_t,size_t> rg = brange[nx];
+     size_t v = nx->getv();
+     size_t c = nx->getc();
+     size_t lo = rg.first, hi = rg.second;
+     while(lo<hi) {
+       if(getxb(bobs[lo],v) <= c) lo++;
+       else std::swap(bobs[lo],bobs[--hi]);
+     }
+     brange.erase(nx);
+     brange[nx->getl()] = std::make_pair(rg.first,lo);
+     brange[nx->getr()] = std::make_pair(lo,rg.second);
+     
+     //the children only narrow the range of v
+     cutrange& cr = bcut[nx];
+     int L = cr.lu[2*v], U = cr.lu[2*v+1];
+     cutrange& cl = bcut[nx->getl()];
+     cl = cr;
+     if((int)c<=U) cl.lu[2*v+1] = c-1;
+     if(U>=L && cl.lu[2*v+1]<L) cl.ngood--;
+     cutrange& cg = bcut[nx->getr()];
+     cg = cr;
+     if((int)c>=L) cg.lu[2*v] = c+1;
+     if(U>=L && U<cg.lu[2*v]) cg.ngood--;
+     bcut.erase(nx);
+   }
+   
+   //the children of nx are about to be killed, give their rows to nx
+   void deathbots_bart(tree::tree_p nx)
+   {
+     size_t first = brange[nx->getl()].first;
+     size_t last = brange[nx->getr()].second;
+     brange.erase(nx->getl());
+     brange.erase(nx->getr());
+     brange[nx] = std::make_pair(first,last);
+     
+     //the left child has the range of nx but for the upper end of v
+     size_t v = nx->getv();
+     cutrange cr = bcut[nx->getl()];
+     int U = bcut[nx->getr()].lu[2*v+1];
+     if(cr.lu[2*v+1]<cr.lu[2*v] && U>=cr.lu[2*v]) cr.ngood++;
+     cr.lu[2*v+1] = U;
+     bcut.erase(nx->getl());
+     bcut.erase(nx->getr());
+     bcut[nx] = cr;
+   }
+   
    void drmu_bart(tree& t, xinfo& xi, dinfo& di, pinfo& pi, double sigma, rn& gen)
    {
      tree::npv bnv;
@@ -260,6 +514,12 @@ public:
    void getgoodvars_bart(tree::tree_p n, xinfo& xi,  std::vector<size_t>& goodvars)
    {
      goodvars.clear();
+     std::map<tree::tree_cp,cutrange>::iterator it = bcut.find(n);
+     if(it!=bcut.end()) {
+       const std::vector<int>& lu = it->second.lu;
+       for(size_t v=0;v!=xi.size();v++) if(lu[2*v+1]>=lu[2*v]) goodvars.push_back(v);
+       return;
+     }
      int L,U;
      for(size_t v=0;v!=xi.size();v++) {//try each variable
        L=0; U = xi[v].size()-1;
@@ -280,14 +540,13 @@ public:
      // Degenerate Trees Strategy (Assumption 2.2)
      if(!aug){
        getgoodvars_bart(nx,xi,goodvars);
-       gen.set_wts(pv);
-       v = gen.discrete();
+       v = pvtab.draw(gen);
        L=0; U=xi[v].size()-1;
        if(!std::binary_search(goodvars.begin(),goodvars.end(),v)){ // if variable is bad
          c=nx->getbadcut(v); // set cutpoint of node to be same as next highest interior node with same variable
        }
        else{ // if variable is good
-         nx->rg(v,&L,&U);
+         getrg_bart(nx,v,L,U);
          c = L + floor(gen.uniform()*(U-L+1)); // draw cutpoint usual way
        }
      }
@@ -295,35 +554,33 @@ public:
      // Set c_j = s_j*E[G] = s_j/P{picking a good var}
      // where  G ~ Geom( P{picking a good var} )
      else{
-       std::vector<size_t> allvars; //all variables
-       std::vector<size_t> badvars; //variables nx can NOT split on
-       std::vector<double> pgoodvars; //vector of goodvars probabilities (from S, our Dirichlet vector draw)
-       std::vector<double> pbadvars; //vector of badvars probabilities (from S,...)
        getgoodvars_bart(nx,xi,goodvars);
-       //size_t ngoodvars=goodvars.size();
-       size_t nbadvars=0; //number of bad vars
+       size_t nbadvars=pv.size()-goodvars.size(); //number of bad vars
        double smpgoodvars=0.; //P(picking a good var)
        double smpbadvars=0.; //P(picking a bad var)
-       //	size_t nbaddraws=0; //number of draws at a particular node
-       //this loop fills out badvars, pgoodvars, pbadvars, 
-       //there may be a better way to do this...
-       for(size_t j=0;j<pv.size();j++){
-         allvars.push_back(j);
-         if(goodvars[j-nbadvars]!=j) {
-           badvars.push_back(j);
-           pbadvars.push_back(pv[j]);
-           smpbadvars+=pv[j];
-           nbadvars++;
-         }
-         else {
-           pgoodvars.push_back(pv[j]);
-           smpgoodvars+=pv[j];
-         }
+       for(size_t j=0;j<goodvars.size();j++) smpgoodvars+=pv[goodvars[j]];
+       //draw a good variable: draws from pvtab until one is good, which
+       //takes 1/smpgoodvars tries on average; after 100 misses draw
+       //straight from the good ones, the result has the same distribution
+       size_t tries=0;
+       do v = pvtab.draw(gen);
+       while(!std::binary_search(goodvars.begin(),goodvars.end(),v) && ++tries<100);
+       if(tries==100) {
+         double u=gen.uniform()*smpgoodvars, cs=0.;
+         size_t k=0;
+         while(k+1<goodvars.size() && u>=(cs+=pv[goodvars[k]])) k++;
+         v = goodvars[k];
        }
-       //set the weights for variable draw and draw a good variable
-       gen.set_wts(pgoodvars);
-       v = goodvars[gen.discrete()];
        if(nbadvars!=0){ // if we have bad vars then we need to augment, otherwise we skip
+         std::vector<size_t> badvars; //variables nx can NOT split on
+         badvars.reserve(nbadvars);
+         for(size_t j=0,k=0;j<pv.size();j++){
+           if(k<goodvars.size() && goodvars[k]==j) k++;
+           else {
+             badvars.push_back(j);
+             smpbadvars+=pv[j];
+           }
+         }
          //gen.set_p(smpgoodvars); // set parameter for G
          //nbaddraws=gen.geometric(); // draw G = g ~ Geom
          // for each bad variable, set its c_j equal to its expected count
@@ -343,8 +600,7 @@ public:
        
        //draw c, the cutpoint
        //int L,U;
-       L=0; U = xi[v].size()-1;
-       nx->rg(v,&L,&U);
+       getrg_bart(nx,v,L,U);
        c = L + floor(gen.uniform()*(U-L+1)); //U-L+1 is number of available split points
      }
      //--------------------------------------------------
@@ -480,43 +736,66 @@ public:
    
    void getsuff_bart(tree& x, tree::tree_p nx, size_t v, size_t c, xinfo& xi, dinfo& di, size_t& nl, double& syl, size_t& nr, double& syr)
    {
-     double *xx;//current x
+     std::pair<size_t,size_t>& rg = brange[nx]; //only the rows in nx
+     if(single) getsuff_bart(r32.data(),rg,v,c,nl,syl,nr,syr);
+     else getsuff_bart(di.y,rg,v,c,nl,syl,nr,syr);
+   }
+   template<class F> void getsuff_bart(const F* ry, std::pair<size_t,size_t>& rg, size_t v, size_t c, size_t& nl, double& syl, size_t& nr, double& syr)
+   {
      nl=0; syl=0.0;
      nr=0; syr=0.0;
      
-     for(size_t i=0;i<di.n;i++) {
-       xx = di.x + i*di.p;
-       if(nx==x.bn(xx,xi)) { //does the bottom node = xx's bottom node
-         if(xx[v] < xi[v][c]) {
+     if(rg.second-rg.first<=rowblock) {
+       for(size_t k=rg.first;k<rg.second;k++) {
+         size_t i = bobs[k];
+         if(getxb(i,v) <= c) {
            nl++;
-           syl += di.y[i];
+           syl += ry[i];
          } else {
            nr++;
-           syr += di.y[i];
+           syr += ry[i];
          }
        }
+       return;
      }
-     
+     long nbk = nrowblocks(rg.second-rg.first);
+     std::vector<size_t> bnl(nbk);
+     std::vector<double> bsyl(nbk), bsyr(nbk);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+#endif
+     for(long bk=0;bk<nbk;bk++) {
+       size_t lo = rg.first+bk*rowblock, hi = lo+rowblock < rg.second ? lo+rowblock : rg.second;
+       size_t l=0;
+       double sl=0.0, sr=0.0;
+       for(size_t k=lo;k<hi;k++) {
+         size_t i = bobs[k];
+         if(getxb(i,v) <= c) {
+           l++;
+           sl += ry[i];
+         } else sr += ry[i];
+       }
+       bnl[bk]=l; bsyl[bk]=sl; bsyr[bk]=sr;
+     }
+     for(long bk=0;bk<nbk;bk++) {
+       nl += bnl[bk];
+       syl += bsyl[bk];
+       syr += bsyr[bk];
+     }
+     nr = rg.second-rg.first-nl;
    }
    
    void getsuff_bart(tree& x, tree::tree_p l, tree::tree_p r, xinfo& xi, dinfo& di, size_t& nl, double& syl, size_t& nr, double& syr)
    {
-     double *xx;//current x
      nl=0; syl=0.0;
      nr=0; syr=0.0;
      
-     for(size_t i=0;i<di.n;i++) {
-       xx = di.x + i*di.p;
-       tree::tree_cp bn = x.bn(xx,xi);
-       if(bn==l) {
-         nl++;
-         syl += di.y[i];
-       }
-       if(bn==r) {
-         nr++;
-         syr += di.y[i];
-       }
-     }
+     std::pair<size_t,size_t>& rgl = brange[l];
+     std::pair<size_t,size_t>& rgr = brange[r];
+     nl = rgl.second-rgl.first;
+     syl = sumy_bart(di,rgl.first,rgl.second);
+     nr = rgr.second-rgr.first;
+     syr = sumy_bart(di,rgr.first,rgr.second);
    }
    
    
@@ -564,6 +843,7 @@ public:
          mul = drawnodemu_bart(nl,syl,pi.tau,sigma,gen);
          mur = drawnodemu_bart(nr,syr,pi.tau,sigma,gen);
          x.birthp(nx,v,c,mul,mur);
+         birthbots_bart(nx,xi,di);
          nv[v]++;
          return true;
        } else {
@@ -598,6 +878,7 @@ public:
        if(log(gen.uniform()) < lalpha) {
          mu = drawnodemu_bart(nl+nr,syl+syr,pi.tau,sigma,gen);
          nv[nx->getv()]--;
+         deathbots_bart(nx);
          x.deathp(nx,mu);
          return true;
        } else {
@@ -670,29 +951,55 @@ public:
    }
    
    
+   //take the tree of the current bottom nodes out of allfit, r=y-allfit
+   template<class F> void dropfit_bart(F* ft, F* rr)
+   {
+     fitbots_bart(ft);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, rowblock) if(n>rowblock)
+#endif
+     for(long k=0;k<(long)n;k++) {
+       allfit[k] = allfit[k]-ft[k];
+       rr[k] = (F)(y[k]-allfit[k]);
+     }
+   }
+   //put it back in after the draw
+   template<class F> void addfit_bart(F* ft)
+   {
+     fitbots_bart(ft);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(static, rowblock) if(n>rowblock)
+#endif
+     for(long k=0;k<(long)n;k++) allfit[k] += ft[k];
+   }
+   
    void draw(double sigma, rn& gen){
+     if(tcut.size()!=m) {tcut.clear(); tcut.resize(m);}
+     if(pvtab.size()!=pv.size()) pvtab.set(pv);
      for(size_t j=0;j<m;j++) {
-       fit3(t[j],xi,p,n,x,ftemp);
-       for(size_t k=0;k<n;k++) {
-         allfit[k] = allfit[k]-ftemp[k];
-         r[k] = y[k]-allfit[k];
-       }
+       bcut.swap(tcut[j]);
+       setbots_bart(t[j],xi,di);
+       if(single) dropfit_bart(ftemp32.data(),r32.data());
+       else dropfit_bart(ftemp,r);
        aug = (aug != 0);
        bd_bart(t[j],xi,di,pi,sigma,nv,pv,aug,gen);
        drmu_bart(t[j],xi,di,pi,sigma,gen);
-       fit3(t[j],xi,p,n,x,ftemp);
-       for(size_t k=0;k<n;k++) allfit[k] += ftemp[k];
+       if(single) addfit_bart(ftemp32.data());
+       else addfit_bart(ftemp);
+       bcut.swap(tcut[j]);
      }
      if(dartOn) {
        draw_s_bart(nv,lpv,theta,gen);
        draw_theta0_bart(const_theta,theta,lpv,a,b,rho,gen);
        for(size_t j=0;j<p;j++) pv[j]=::exp(lpv[j]);
+       pvtab.set(pv);
      }
    }
 //   void draw_s(rn& gen);
    double f(size_t i) {return allfit[i];}
 protected:
    size_t m;  //number of trees
+   tree_pool pool; //nodes of the trees, before t so that it outlives them
    std::vector<tree> t; //the trees
    pinfo pi; //prior and mcmc info
    //data
@@ -708,6 +1015,35 @@ protected:
    double a,b,rho,theta,omega;
    std::vector<size_t> nv;
    std::vector<double> pv, lpv;
+   alias pvtab; //alias table of pv for the split variable draws, rebuilt
+                //when pv changes and cleared when it may have
+   //x binned against the cutpoints, row i at [i*p], see binx_bart
+   std::vector<unsigned char> xb8;
+   std::vector<unsigned short> xb16;
+   bool xbwide;
+   size_t getxb(size_t i, size_t v) {return xbwide ? xb16[i*p+v] : xb8[i*p+v];}
+   //rows grouped by bottom node of the tree being drawn, see setbots_bart
+   std::vector<size_t> bobs, bid;
+   std::map<tree::tree_cp,std::pair<size_t,size_t> > brange;
+   //cutpoints left to each bottom node of the tree being drawn: variable v
+   //can split at the cutpoints lu[2v]..lu[2v+1], ngood variables have any.
+   //Kept for every tree in tcut between draws, updated by birthbots_bart and
+   //deathbots_bart, and dropped whenever the trees or the cutpoints change
+   //otherwise
+   struct cutrange {
+     std::vector<int> lu;
+     size_t ngood;
+   };
+   std::map<tree::tree_cp,cutrange> bcut;
+   std::vector<std::map<tree::tree_cp,cutrange> > tcut;
+   //the loops over the rows run over blocks of rowblock rows on nthreads
+   //threads, sums are added up block by block in order so that the draws do
+   //not depend on nthreads
+   static const size_t rowblock = 4096;
+   int nthreads;
+   size_t nrowblocks(size_t nr) {return (nr+rowblock-1)/rowblock;}
+   bool single; //r and ftemp as float in r32 and ftemp32, see setbuf_bart
+   std::vector<float> r32, ftemp32;
 };
 
 #endif
@@ -0,0 +1,98 @@
+/*
+ *  BART: Bayesian Additive Regression Trees
+ *  Copyright (C) 2017 Robert McCulloch and Rodney Sparapani
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+/*
+ *  Modifications by Jungang Zou, 2024.
+ *  - C++ version of the cutpoint part of the R function bartModelMatrix, so
+ *  that bart_model does not need to call back into R.
+ *
+ *  These modifications comply with the terms of the GNU General Public License
+ *  version 2 (GPL-2).
+ */
+
+#ifndef GUARD_cutpoints_h
+#define GUARD_cutpoints_h
+
+#include "common.h"
+#include "tree.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+//quantile of the sorted x as stats::quantile(type=7)
+double quantile7_bart(const std::vector<double>& xs, double prob)
+{
+   size_t n = xs.size();
+   double index = (n-1)*prob;
+   size_t lo = std::floor(index + 4*DBL_EPSILON);
+   size_t hi = std::ceil(index - 4*DBL_EPSILON);
+   double q = xs[lo];
+   double h = index - lo;
+   if(index > lo && xs[hi] != q) q = (1-h)*q + h*xs[hi];
+   return q;
+}
+
+//numcut cutpoints equally spaced strictly between from and to
+void cutgrid_bart(double from, double to, size_t numcut, std::vector<double>& cuts)
+{
+   double by = (to-from)/(numcut+1.0);
+   cuts.resize(numcut);
+   for(size_t j=0;j<numcut;j++) cuts[j] = from + (j+1)*by;
+}
+
+//cutpoints of the n x p (column major) x as bartModelMatrix builds them:
+//  - a constant column gets its value as the only cutpoint and is listed in
+//    rmvars as -(j+1)
+//  - cont: numcut equally spaced points between min and max
+//  - fewer than numcut distinct values: the midpoints between them
+//  - usequants: the numcut inner quantiles (type 7)
+//  - otherwise numcut equally spaced points between min and max
+//nc[j] is the number of cutpoints of column j
+void makecuts_bart(size_t n, size_t p, const double *x, size_t numcut, bool usequants, bool cont, xinfo& xi, std::vector<int>& nc, std::vector<int>& rmvars)
+{
+   xi.resize(p);
+   nc.resize(p);
+   rmvars.clear();
+   std::vector<double> xs(n), us;
+   for(size_t j=0;j<p;j++) {
+      std::copy(x+j*n,x+(j+1)*n,xs.begin());
+      std::sort(xs.begin(),xs.end());
+      us.assign(xs.begin(),xs.end());
+      us.erase(std::unique(us.begin(),us.end()),us.end());
+      size_t k = us.size();
+      if(k<=1) {
+         rmvars.push_back(-(int)(j+1));
+         xi[j].assign(1, k==0 ? NAN : us[0]);
+      } else if(cont) {
+         cutgrid_bart(us[0],us[k-1],numcut,xi[j]);
+      } else if(k<numcut) {
+         xi[j].resize(k-1);
+         for(size_t i=0;i<k-1;i++) xi[j][i] = 0.5*(us[i]+us[i+1]);
+      } else if(usequants) {
+         xi[j].resize(numcut);
+         for(size_t i=0;i<numcut;i++) xi[j][i] = quantile7_bart(xs,(i+1.0)/(numcut+1.0));
+      } else {
+         cutgrid_bart(us[0],us[k-1],numcut,xi[j]);
+      }
+      nc[j] = xi[j].size();
+   }
+}
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ *  SBMTrees: Sequential imputation with Bayesian Trees Mixed-Effects models
+ *  Copyright (C) 2024 Jungang Zou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+#ifndef GUARD_ensemble_h
+#define GUARD_ensemble_h
+
+#include "tree.h"
+
+//compiled copy of the kept draws of a bart fit, used for prediction instead
+//of parsing the text trees as cpwbart does.
+//The nodes of all trees sit in flat arrays: an interior node k splits on
+//var[k] at the cutpoint index cut[k], its children are child[k] (left) and
+//child[k]+1 (right); a bottom node has var[k] = -1 and its mu in val[k].
+//The root of tree j of draw i is root[i*m+j]. Prediction takes x binned
+//by bart::getbin, so a row goes left iff xb[var[k]] <= cut[k].
+class ensemble {
+public:
+   ensemble():nd(0),m(0),p(0) {}
+
+   //drop all draws, the trees to be added have m trees on p variables
+   void clear(size_t m, size_t p) {
+      this->nd=0; this->m=m; this->p=p;
+      var.clear(); val.clear(); child.clear(); cut.clear(); root.clear();
+   }
+   //add the next tree, every m trees make one draw
+   void add(tree& t, xinfo& xi) {
+      size_t k = var.size();
+      var.push_back(-1); val.push_back(0.); child.push_back(0); cut.push_back(0);
+      root.push_back(k);
+      compile(&t,k,xi);
+      nd = root.size()/m;
+   }
+   size_t getnd() const {return nd;}
+   size_t getm() const {return m;}
+   size_t getp() const {return p;}
+
+   //sum of the trees of draw i at the binned x
+   template<class B> double fit(size_t i, const B *xb) const {
+      double f=0.;
+      const size_t *r = &root[i*m];
+      for(size_t j=0;j<m;j++) {
+         int k = r[j];
+         while(var[k]>=0) k = child[k] + (xb[var[k]] <= cut[k] ? 0 : 1);
+         f += val[k];
+      }
+      return f;
+   }
+   //the draws in the text format of cwbart's treedraws, as read by cpwbart
+   void write(std::ostream& os) const {
+      os << nd << " " << m << " " << p << std::endl;
+      for(size_t i=0;i<nd*m;i++) {
+         os << treesize(root[i]) << std::endl;
+         writenode(os,root[i],1);
+      }
+   }
+   //xb is the binned x, p x np (column stack), yhat is nd x np in column
+   //major order
+   template<class B> void predict(size_t np, const B *xb, double *yhat) const {
+      for(size_t k=0;k<np;k++) {
+         const B *xx = xb + k*p;
+         for(size_t i=0;i<nd;i++) yhat[i + k*nd] = fit(i,xx);
+      }
+   }
+private:
+   void compile(tree::tree_p n, size_t k, xinfo& xi) {
+      if(n->getl()) {
+         size_t c = var.size();
+         var.resize(c+2); val.resize(c+2); child.resize(c+2); cut.resize(c+2);
+         var[k] = n->getv();
+         val[k] = 0.;
+         child[k] = c;
+         cut[k] = n->getc();
+         compile(n->getl(),c,xi);
+         compile(n->getr(),c+1,xi);
+      } else {
+         var[k] = -1;
+         val[k] = n->gettheta();
+         child[k] = 0;
+         cut[k] = 0;
+      }
+   }
+   size_t treesize(int k) const {
+      return var[k]<0 ? 1 : 1 + treesize(child[k]) + treesize(child[k]+1);
+   }
+   void writenode(std::ostream& os, int k, size_t nid) const {
+      if(var[k]<0) {
+         os << nid << " 0 0 " << val[k] << std::endl;
+      } else {
+         os << nid << " " << var[k] << " " << cut[k] << " 0" << std::endl;
+         writenode(os,child[k],2*nid);
+         writenode(os,child[k]+1,2*nid+1);
+      }
+   }
+
+   size_t nd,m,p; //number of draws, trees per draw, variables
+   std::vector<int> var;
+   std::vector<double> val;
+   std::vector<int> child;
+   std::vector<int> cut;
+   std::vector<size_t> root;
+};
+
+#endif
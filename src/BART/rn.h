@@ -23,6 +23,8 @@
 #define GUARD_rn_h
 
 #include <cmath>
+#include <cstdint>
+#include <vector>
 // double log_sum_exp(std::vector<double>& v){
 //   double mx=v[0],sm=0.;
 //   for(size_t i=0;i<v.size();i++) if(v[i]>mx) mx=v[i];
@@ -51,6 +53,47 @@ class rn
   virtual ~rn() {}
 };
 
+//alias table (Walker, Vose) of a fixed discrete distribution: set() is
+//O(p), every draw after that takes one uniform and O(1) time
+class alias
+{
+ public:
+  void set(const std::vector<double>& w) {
+    size_t k=w.size();
+    double smw=0.;
+    for(size_t j=0;j<k;j++) smw+=w[j];
+    prob.resize(k); al.resize(k);
+    small.clear(); large.clear();
+    for(size_t j=0;j<k;j++) {
+      prob[j]=w[j]*k/smw;
+      al[j]=j;
+      if(prob[j]<1.) small.push_back(j); else large.push_back(j);
+    }
+    while(small.size() && large.size()) {
+      size_t j=small.back(), l=large.back();
+      small.pop_back();
+      al[j]=l;
+      prob[l]-=1.-prob[j];
+      if(prob[l]<1.) {large.pop_back(); small.push_back(l);}
+    }
+    //what is left is 1 up to rounding
+    for(size_t j=0;j<small.size();j++) prob[small[j]]=1.;
+    for(size_t j=0;j<large.size();j++) prob[large[j]]=1.;
+  }
+  void clear() {prob.clear(); al.clear();}
+  size_t size() const {return prob.size();}
+  size_t draw(rn& gen) const {
+    double u=gen.uniform()*prob.size();
+    size_t j=(size_t)u;
+    if(j>=prob.size()) j=prob.size()-1;
+    return (u-j<prob[j]) ? j : al[j];
+  }
+ private:
+  std::vector<double> prob; //probability of keeping column j
+  std::vector<size_t> al;   //the other outcome of column j
+  std::vector<size_t> small, large; //work space of set()
+};
+
 //abstract random number generator based on R/Rcpp
 class arn: public rn
 {
@@ -138,4 +181,138 @@ class arn: public rn
   Rcpp::RNGScope RNGstate;
 };
 
+//seedable random number generator: xoshiro256** seeded by splitmix64, with
+//its own normal (polar method), gamma (Marsaglia and Tsang) and chi-square
+//draws. It does not touch the global R RNG, so each model can own one and
+//draw from it off the main thread, and the same seed gives the same draws on
+//every platform. crn(seed, stream) gives independent streams of one seed.
+class crn: public rn
+{
+ public:
+  //constructor
+  crn() {set_seed(5489u);}
+  crn(uint64_t seed) {set_seed(seed);}
+  crn(uint64_t seed, uint64_t stream) {set_seed(seed, stream);}
+  //virtual
+  virtual ~crn() {}
+  void set_seed(uint64_t seed) {
+    uint64_t x=seed;
+    for(int k=0;k<4;k++) s[k]=splitmix64(x);
+    has_gauss=false;
+  }
+  //stream k of seed: the state of set_seed(seed) moved on by k jumps of
+  //2^128 draws, so the streams never overlap
+  void set_seed(uint64_t seed, uint64_t stream) {
+    set_seed(seed);
+    for(uint64_t k=0;k<stream;k++) jump();
+  }
+  virtual double normal() {
+    if(has_gauss) {has_gauss=false; return gauss;}
+    double x1, x2, r2;
+    do {
+      x1=2.*this->uniform()-1.;
+      x2=2.*this->uniform()-1.;
+      r2=x1*x1+x2*x2;
+    } while(r2>=1. || r2==0.);
+    double f=std::sqrt(-2.*std::log(r2)/r2);
+    gauss=f*x1;
+    has_gauss=true;
+    return f*x2;
+  }
+  //in (0,1)
+  virtual double uniform() {return ((next()>>11)+.5)*(1./9007199254740992.);}
+  virtual double chi_square(double df) {return 2.*this->gamma(.5*df, 1.);}
+  virtual double exp() {return -std::log(this->uniform());}
+  virtual double log_gamma(double shape) {
+    double y=log(this->gamma_mt(shape+1.)), z=log(this->uniform())/shape;
+    return y+z;
+  }
+  virtual double gamma(double shape, double rate) {
+    if(shape<0.01) return ::exp(this->log_gamma(shape))/rate;
+    if(shape<1.) return this->gamma_mt(shape+1.)*std::pow(this->uniform(), 1./shape)/rate;
+    return this->gamma_mt(shape)/rate;
+  }
+  virtual double beta(double a, double b) {
+    double x1=this->gamma(a, 1.), x2=this->gamma(b, 1.);
+    return x1/(x1+x2);
+  }
+  virtual size_t discrete() {
+    size_t p=wts.size(), x=0;
+    double u=this->uniform(), cs=wts[0];
+    while(u>cs && x+1<p) cs += wts[++x];
+    return x;
+  }
+  //number of failures before the first success
+  virtual size_t geometric(double p) {
+    if(p>=1.) return 0;
+    return (size_t)std::floor(std::log(this->uniform())/std::log1p(-p));
+  }
+  virtual void set_wts(std::vector<double>& _wts) {
+    double smw=0.;
+    wts.clear();
+    for(size_t j=0;j<_wts.size();j++) smw+=_wts[j];
+    for(size_t j=0;j<_wts.size();j++) wts.push_back(_wts[j]/smw);
+  }
+  virtual std::vector<double> log_dirichlet(std::vector<double>& alpha){
+    size_t k=alpha.size();
+    std::vector<double> draw(k);
+    double lse;
+    for(size_t j=0;j<k;j++) draw[j]=this->log_gamma(alpha[j]);
+    double mx=draw[0],sm=0.;
+    for(size_t i=0;i<draw.size();i++) if(draw[i]>mx) mx=draw[i];
+    for(size_t i=0;i<draw.size();i++){
+      sm += std::exp(draw[i]-mx);
+    }
+    lse= mx+log(sm);
+    for(size_t j=0;j<k;j++) draw[j] -= lse;
+    return draw;
+  }
+  static uint64_t splitmix64(uint64_t& x) {
+    uint64_t z=(x+=0x9E3779B97F4A7C15ull);
+    z=(z^(z>>30))*0xBF58476D1CE4E5B9ull;
+    z=(z^(z>>27))*0x94D049BB133111EBull;
+    return z^(z>>31);
+  }
+ private:
+  static uint64_t rotl(uint64_t x, int k) {return (x<<k)|(x>>(64-k));}
+  //the state 2^128 draws ahead
+  void jump() {
+    static const uint64_t J[4]={0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull,
+                                0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+    uint64_t t[4]={0,0,0,0};
+    for(int i=0;i<4;i++)
+      for(int b=0;b<64;b++) {
+        if(J[i] & (1ull<<b))
+          for(int k=0;k<4;k++) t[k]^=s[k];
+        next();
+      }
+    for(int k=0;k<4;k++) s[k]=t[k];
+  }
+  uint64_t next() {
+    uint64_t result=rotl(s[1]*5, 7)*9, t=s[1]<<17;
+    s[2]^=s[0]; s[3]^=s[1]; s[1]^=s[2]; s[0]^=s[3];
+    s[2]^=t; s[3]=rotl(s[3], 45);
+    return result;
+  }
+  //Marsaglia and Tsang (2000), shape >= 1
+  double gamma_mt(double shape) {
+    double d=shape-1./3., c=1./std::sqrt(9.*d);
+    for(;;) {
+      double x, v;
+      do {
+        x=this->normal();
+        v=1.+c*x;
+      } while(v<=0.);
+      v=v*v*v;
+      double u=this->uniform();
+      if(u<1.-.0331*x*x*x*x) return d*v;
+      if(std::log(u)<.5*x*x+d*(1.-v+std::log(v))) return d*v;
+    }
+  }
+  uint64_t s[4];
+  bool has_gauss;
+  double gauss;
+  std::vector<double> wts;
+};
+
 #endif 
@@ -34,6 +34,7 @@
 #include <map>
 #include <cmath>
 #include <cstddef>
+#include <new>
 
 //--------------------------------------------------
 //xinfo xi, then xi[v][c] is the c^{th} cutpoint for variable v.
@@ -50,6 +51,28 @@ struct node_info {
    double theta;   //theta
 };
 
+//--------------------------------------------------
+//pool of tree nodes: nodes are carved from blocks of nblock nodes and
+//recycled through a free list, so a node never moves and growing or
+//killing a tree does no malloc once the blocks are there. A tree whose
+//top node has a pool gets all its children from it (see tree::setpool),
+//the pool has to outlive the tree.
+class tree;
+class tree_pool {
+public:
+   tree_pool(): next(nblock) {}
+   ~tree_pool();
+   tree* get();
+   void put(tree* n) {free.push_back(n);}
+private:
+   tree_pool(const tree_pool&);
+   tree_pool& operator=(const tree_pool&);
+   static const size_t nblock = 256;
+   std::vector<tree*> blocks; //each holds nblock nodes
+   size_t next;               //next unused node in blocks.back()
+   std::vector<tree*> free;   //nodes given back
+};
+
 //--------------------------------------------------
 class tree {
 public:
@@ -61,9 +84,9 @@ public:
    typedef std::vector<tree_p> npv; 
    typedef std::vector<tree_cp> cnpv;
    //contructors,destructors--------------------
-   tree(): theta(0.0),v(0),c(0),p(0),l(0),r(0) {}
-   tree(const tree& n): theta(0.0),v(0),c(0),p(0),l(0),r(0) {cp(this,&n);}
-   tree(double itheta): theta(itheta),v(0),c(0),p(0),l(0),r(0) {}
+   tree(): theta(0.0),v(0),c(0),p(0),l(0),r(0),pool(0) {}
+   tree(const tree& n): theta(0.0),v(0),c(0),p(0),l(0),r(0),pool(0) {cp(this,&n);}
+   tree(double itheta): theta(itheta),v(0),c(0),p(0),l(0),r(0),pool(0) {}
    
    friend std::istream& operator>>(std::istream& is, tree& t)
    {
@@ -96,7 +119,7 @@ public:
      
      //now loop through the rest of the nodes knowing parent is already there.
      for(size_t i=1;i!=nv.size();i++) {
-       tree::tree_p np = new tree;
+       tree::tree_p np = t.newnode();
        np->v = nv[i].v; np->c=nv[i].c; np->theta=nv[i].theta;
        tid = nv[i].id;
        pts[tid] = np;
@@ -129,18 +152,9 @@ public:
    
    
    void tonull(){
-     size_t ts = treesize();
-     //loop invariant: ts>=1
-     while(ts>1) { //if false ts=1
-       npv nv;
-       getnogs(nv);
-       for(size_t i=0;i<nv.size();i++) {
-         delete nv[i]->l;
-         delete nv[i]->r;
-         nv[i]->l=0;
-         nv[i]->r=0;
-       }
-       ts = treesize(); //make invariant true
+     if(l) {
+       freenode(l);
+       freenode(r);
      }
      theta=0.0;
      v=0;c=0;
@@ -155,6 +169,17 @@ public:
    return *this;};
    
    //interface--------------------
+   //take the nodes from pool np (0: new/delete), the children are moved
+   //there if the tree has any
+   void setpool(tree_pool* np) {
+     if(np==pool) return;
+     if(l) {
+       tree o(*this);
+       tonull();
+       pool=np;
+       cp(this,&o);
+     } else pool=np;
+   }
    //set
    void settheta(double theta) {this->theta=theta;}
    void setv(size_t v) {this->v = v;}
@@ -225,9 +250,9 @@ public:
      }
      
      //add children to bottom node np
-     tree_p l = new tree;
+     tree_p l = newnode();
      l->theta=thetal;
-     tree_p r = new tree;
+     tree_p r = newnode();
      r->theta=thetar;
      np->l=l;
      np->r=r;
@@ -243,8 +268,8 @@ public:
        return false;
      }
      if(nb->isnog()) {
-       delete nb->l;
-       delete nb->r;
+       freenode(nb->l);
+       freenode(nb->r);
        nb->l=0;
        nb->r=0;
        nb->v=0;
@@ -256,9 +281,9 @@ public:
        return false;
      }};
    void birthp(tree_p np,size_t v, size_t c, double thetal, double thetar){
-     tree_p l = new tree;
+     tree_p l = newnode();
      l->theta=thetal;
-     tree_p r = new tree;
+     tree_p r = newnode();
      r->theta=thetar;
      np->l=l;
      np->r=r;
@@ -266,8 +291,8 @@ public:
      l->p = np;
      r->p = np;
    };
-   void deathp(tree_p nb, double theta){delete nb->l;
-     delete nb->r;
+   void deathp(tree_p nb, double theta){freenode(nb->l);
+     freenode(nb->r);
      nb->l=0;
      nb->r=0;
      nb->v=0;
@@ -312,6 +337,12 @@ public:
        return r->bn(x,xi);
      }
    }; //find Bottom Node
+   //find Bottom Node from binned x: x[v] < xi[v][c] iff xb[v] <= c
+   template<class B> tree_p bnb(const B *xb){
+     tree_p n = this;
+     while(n->l) n = (xb[n->v] <= n->c) ? n->l : n->r;
+     return n;
+   }
    void rg(size_t v, int* L, int* U)
    {
      if(this->p==0)  {
@@ -430,7 +461,22 @@ private:
    tree_p p; //parent
    tree_p l; //left child
    tree_p r; //right child
+   tree_pool* pool; //where the nodes come from, 0 for new/delete
    //utiity functions
+   tree_p newnode() {
+     tree_p n = pool ? pool->get() : new tree;
+     n->pool = pool;
+     return n;
+   }; //a node from the pool of this one
+   void freenode(tree_p n) {
+     if(n->l) {
+       freenode(n->l);
+       freenode(n->r);
+       n->l=0; n->r=0;
+     }
+     if(n->pool) n->pool->put(n);
+     else delete n;
+   }; //give back n and its descendants
    void cp(tree_p n,  tree_cp o)
      //assume n has no children (so we don't have to kill them)
      //recursion down
@@ -445,16 +491,34 @@ private:
        n->c = o->c;
        
        if(o->l) { //if o has children
-         n->l = new tree;
+         n->l = n->newnode();
          (n->l)->p = n;
          cp(n->l,o->l);
-         n->r = new tree;
+         n->r = n->newnode();
          (n->r)->p = n;
          cp(n->r,o->r);
        }
    }; //copy tree
 };
 
+inline tree_pool::~tree_pool() {
+   for(size_t i=0;i<blocks.size();i++) ::operator delete(blocks[i]);
+}
+inline tree* tree_pool::get() {
+   void* n;
+   if(free.size()) {
+      n = free.back();
+      free.pop_back();
+   } else {
+      if(next==nblock) {
+         blocks.push_back(static_cast<tree*>(::operator new(nblock*sizeof(tree))));
+         next=0;
+      }
+      n = blocks.back()+next++;
+   }
+   return new(n) tree;
+}
+
 
 #endif
 
@@ -35,325 +35,416 @@
 #define UTILS_H_
 #include "utils.h"
 #endif
+
+#ifndef RE_KERNELS_H_
+#define RE_KERNELS_H_
+#include "re_kernels.h"
+#endif
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #ifndef DP_SAMPLER_H_
 #define DP_SAMPLER_H_
 #include "DP_sampler.h"
 #endif
 
+#ifndef DP_STATE_H_
+#define DP_STATE_H_
+#include "dp_state.h"
+#endif
+
+#include "BART/rn.h"
+
 
 using namespace Rcpp;
 
-// [[Rcpp::export]]
-List DP(List parameters, double M, long N_truncated, long N_sample, bool CDP = true){
-  
+// index h drawn with probability proportional to exp(log_w[h]) by inverting
+// the cumulative weights at the uniform u01; w is work space of length K
+long dp_sample_log_weights(const double* log_w, long K, double* w, double u01){
+  double m = log_w[0];
+  for(long h = 1; h < K; ++h)
+    m = std::max(m, log_w[h]);
+  double total = 0;
+  for(long h = 0; h < K; ++h){
+    w[h] = std::exp(log_w[h] - m);
+    total += w[h];
+  }
+  double u = u01 * total;
+  double cum = 0;
+  for(long h = 0; h < K - 1; ++h){
+    cum += w[h];
+    if(u < cum)
+      return h;
+  }
+  return K - 1;
+}
+
+// body(begin, end, gen) on the blocks [begin, end) of dp_block samples, in
+// parallel. Block b draws from its own crn seeded from the R RNG in block
+// order, so the draws do not depend on the number of threads. body runs off
+// the R thread and must not call R.
+const long dp_block = 1024;
+
+template<class F> void dp_for_blocks(long N, int nthreads, F body){
+  long n_blocks = (N + dp_block - 1) / dp_block;
+  std::vector<unsigned int> seeds(n_blocks);
+  for(long b = 0; b < n_blocks; ++b)
+    seeds[b] = (unsigned int)(R::unif_rand() * 4294967295.0);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+#endif
+  for(long b = 0; b < n_blocks; ++b){
+    crn gen(seeds[b]);
+    body(b * dp_block, std::min(N, (b + 1) * dp_block), gen);
+  }
+}
+
+// Assignments of the univariate kernel N(y_h, sigma^2) without a scan of all
+// K atoms. With the atoms sorted by location, those within dp_window sigma of
+// x are found by binary search and weighed exactly. Any other atom has weight
+// at most pi_h exp(-dp_window^2 / 2); that bound is the envelope of a
+// rejection step drawing the outside atoms in proportion to pi_h, so the draw
+// is exact. A sample with no weight in its window, or still without an atom
+// after dp_tries rounds of the rejection step (a window holding only atoms of
+// tiny weight), falls back to the full scan, which keeps the draw exact.
+const double dp_window = 8;
+const int dp_tries = 64;
+
+void dp_assign_univariate(const double* x, long N, dp_state& s, double sigma, int nthreads = 1){
+  long K = s.K();
+  std::vector<long> rank(K);
+  for(long h = 0; h < K; ++h)
+    rank[h] = h;
+  std::stable_sort(rank.begin(), rank.end(), [&s](long g, long h){return s.y(g, 0) < s.y(h, 0);});
+  std::vector<double> y_sorted(K), pi_cum(K + 1);
+  pi_cum[0] = 0;
+  for(long r = 0; r < K; ++r){
+    y_sorted[r] = s.y(rank[r], 0);
+    pi_cum[r + 1] = pi_cum[r] + s.pi[rank[r]];
+  }
+  const double inv_2s2 = 1 / (2 * sigma * sigma);
+  const double tail = std::exp(-dp_window * dp_window / 2);
+  dp_for_blocks(N, nthreads, [&](long begin, long end, rn& gen){
+    std::vector<double> w(K), log_w(K);
+    for(long i = begin; i < end; ++i){
+      const double xi = x[i];
+      long lo = std::lower_bound(y_sorted.begin(), y_sorted.end(), xi - dp_window * sigma) - y_sorted.begin();
+      long hi = std::upper_bound(y_sorted.begin() + lo, y_sorted.end(), xi + dp_window * sigma) - y_sorted.begin();
+      double inside = 0;
+      for(long r = lo; r < hi; ++r){
+        double e = xi - y_sorted[r];
+        w[r] = s.pi[rank[r]] * std::exp(-e * e * inv_2s2);
+        inside += w[r];
+      }
+      const double outside = pi_cum[K] - (pi_cum[hi] - pi_cum[lo]);
+      const double envelope = outside > 0 ? outside * tail : 0;
+      long r = -1;
+      for(int t = 0; inside > 0 && r < 0 && t < dp_tries; ++t){
+        double u = gen.uniform() * (inside + envelope);
+        if(u < inside){
+          r = hi - 1;
+          double cum = 0;
+          for(long q = lo; q < hi - 1; ++q){
+            cum += w[q];
+            if(u < cum){
+              r = q;
+              break;
+            }
+          }
+        }else{
+          // an atom outside [lo, hi) drawn in proportion to pi, accepted with
+          // probability exp(-e^2 / (2 sigma^2)) / tail
+          double v = gen.uniform() * outside;
+          if(v >= pi_cum[lo])
+            v += pi_cum[hi] - pi_cum[lo];
+          long q = std::upper_bound(pi_cum.begin() + 1, pi_cum.end(), v) - pi_cum.begin() - 1;
+          q = std::min(q, K - 1);
+          if(q >= lo && q < hi)
+            continue;
+          double e = xi - y_sorted[q];
+          if(gen.uniform() * tail < std::exp(-e * e * inv_2s2))
+            r = q;
+        }
+      }
+      if(r < 0){
+        for(long q = 0; q < K; ++q){
+          double e = xi - y_sorted[q];
+          log_w[q] = log(s.pi[rank[q]]) - e * e * inv_2s2;
+        }
+        r = dp_sample_log_weights(log_w.data(), K, w.data(), gen.uniform());
+      }
+      s.cluster[i] = rank[r];
+    }
+  });
+}
+
+// draw a truncated DP with N_truncated atoms from the prior in parameters
+// (completed by DP_sampler) and assign N_sample samples to them; with CDP the
+// atoms are centered so that the mixture has mean zero
+dp_state dp_init(List parameters, double M, long N_truncated, long N_sample, bool CDP = true){
+  dp_state s;
   NumericVector p(N_truncated);
   IntegerVector index = seq(0, N_truncated - 1);
-  IntegerVector cluster;
-  NumericMatrix samples;
   if(N_truncated > 1){
     NumericVector b = rbeta(N_truncated, 1, M);
-    NumericVector index(N_truncated);
+    double rest = 1;
     p[0] = b[0];
     for(int i = 1; i <= N_truncated-1; i++){
-      p[i] = b[i] * prodC(1.0 - as<NumericVector>(b[seqC(0,i-1)]));
+      rest *= 1.0 - b[i - 1];
+      p[i] = b[i] * rest;
     }
   }else{
     p[0] = 1;
   }
-  p.attr("names") = index;
   List samples_parameters = DP_sampler(N_truncated, parameters);
-  NumericMatrix y = samples_parameters["y"];
-  //Rcout << y << std::endl;
-  std::string dist = as<std::string>(parameters["distribution"]);
-  
-  if(dist == "normal"){
-    int dp = as<int>(parameters["p"]);
-    parameters["CDP"] = CDP;
-    CharacterVector rowname(index.begin(), index.end());
-    rownames(y) = rowname;
-    cluster = sample(index, N_sample, true, p);
-    if(CDP == true){
-      for(int i = 0; i < dp; ++i){
-        y (_,i) = y (_,i) - sum(y(_,i) * p);
-      }
-    }
-    NumericMatrix samples(N_sample, dp);
-    for(int i = 0; i < N_sample; ++i){
-      samples(i,_) = y(cluster[i], _);
+  if(as<std::string>(parameters["distribution"]) != "normal")
+    stop("DP: only the normal distribution is supported");
+  s.y = as<arma::mat>(samples_parameters["y"]);
+  s.p = as<int>(parameters["p"]);
+  s.CDP = CDP;
+  parameters["CDP"] = CDP;
+  IntegerVector cluster = sample(index, N_sample, true, p);
+  if(CDP == true){
+    for(int i = 0; i < s.p; ++i){
+      double centre = 0;
+      for(long h = 0; h < N_truncated; ++h)
+        centre += s.y(h, i) * p[h];
+      s.y.col(i) -= centre;
     }
-    rownames(samples) = cluster;
-    if(parameters.containsElementNamed("sd"))
-      return List::create(Named("samples") = samples, Named("cluster") = cluster, Named("pi") = p, Named("parameters") = parameters, Named("y") = y, Named("M") = M, Named("lambda") = parameters["lambda"], Named("sigma") = parameters["sigma"]);
-    else
-      return List::create(Named("samples") = samples, Named("cluster") = cluster, Named("pi") = p, Named("parameters") = parameters, Named("y") = y, Named("M") = M, Named("lambda") = parameters["lambda"], Named("Sigma") = parameters["Sigma"]);
   }
-  return List::create(Named("samples") = samples, Named("cluster") = cluster, Named("index") = index, Named("pi") = p, Named("parameters") = parameters, Named("y") = y, Named("lambda") = parameters["lambda"]);
+  
+  s.univariate = parameters.containsElementNamed("sd");
+  s.pi_prior = parameters["pi"];
+  s.a = parameters["a"];
+  s.b = parameters["b"];
+  s.lambda = parameters["lambda"];
+  s.mu = as<arma::vec>(parameters["mu"]);
+  if(s.univariate){
+    s.sd = parameters["sd"];
+    s.v = parameters["v"];
+    s.k = parameters["k"];
+    s.sigma = parameters["sigma"];
+  }else{
+    s.cov = as<arma::mat>(parameters["cov"]);
+    s.d = parameters["d"];
+    s.Psi = as<arma::mat>(parameters["Psi"]);
+    s.Sigma = as<arma::mat>(parameters["Sigma"]);
+  }
+  s.M = M;
+  s.pi = as<arma::vec>(p);
+  s.cluster = as<std::vector<int>>(cluster);
+  s.nk.assign(N_truncated, 0);
+  s.samples.set_size(N_sample, s.p);
+  for(long i = 0; i < N_sample; ++i){
+    s.nk[s.cluster[i]]++;
+    s.samples.row(i) = s.y.row(s.cluster[i]);
+  }
+  return s;
 }
 
-// [[Rcpp::export]]
-List update_DP_normal(NumericMatrix X, List tau, double L = -1, double U = 2){
-  List parameters = tau["parameters"];
-  double M = tau["M"];
+// one Gibbs update of the DP mixture s given the data X (N x p): lambda, the
+// assignments, the stick-breaking weights and M, the atoms and the kernel
+// (co)variance. M is drawn truncated to [N^L, N^U]. With slice = true the
+// assignments are drawn by the slice sampler of Walker (2007): sample i gets
+// u_i ~ U(0, pi[cluster[i]]) and then only the atoms with pi_h >= u_i are
+// evaluated, each with weight N(x_i | y_h, Sigma). The assignments run on
+// nthreads threads.
+void dp_update_normal(const NumericMatrix& X, dp_state& s, double L = -1, double U = 2, bool slice = false, int nthreads = 1){
   long N = X.nrow();
-  if(strcmp(parameters["distribution"], "normal") == 0){
-    int p = as<int>(parameters["p"]);
-    double sigma = 1;
-    NumericMatrix Sigma;
-    if(parameters.containsElementNamed("sd")){
-      sigma = tau["sigma"];
-    }else{
-      Sigma = as<NumericMatrix>(tau["Sigma"]);
-    }
-    
-    
-    IntegerVector cluster = tau["cluster"];
-    NumericVector pi = tau["pi"];
-    NumericMatrix y = tau["y"];
-    bool CDP = parameters["CDP"];
-    double lambda = tau["lambda"];
-    if(parameters.containsElementNamed("sd")){
-      lambda = rinvgamma(y.length() / 2 + as<double>(parameters["a"]), as<double>(parameters["b"]) + innerProduct(y - as<double>(parameters["mu"]), y - as<double>(parameters["mu"])) / 2 / pow(sigma, 2));
-    }else{
-      lambda = rinvgamma(y.length() / 2 + as<double>(parameters["a"]), as<double>(parameters["b"]) + quadratic_form(y, as<NumericVector>(parameters["mu"]), Sigma) / 2);
-    }
-   for(int i = 0 ; i < X.rows(); ++i){
-     NumericVector log_density(y.nrow());
-     NumericVector X_row = X(i, _);
-     for(int j = 0 ; j < y.nrow(); ++j){
-       NumericVector log_dens;
-       NumericVector mu = y(j,_);
-       //Rcout << mu[0] << std::endl;
-       double pj = pi[j];
-       if(parameters.containsElementNamed("sd")){
-       //if(p == 1){
-         log_dens = dnorm(X_row, mu[0], sigma, true);
-         log_density[j] = log_dens[0] + log(pj);
-       }else{
-         NumericMatrix X_ = NumericMatrix(1, X_row.length(), X_row.begin());
-         log_dens = wrap(dmvnorm(as<mat>(X_), mu, as<mat>(Sigma), true));
-         //Rcout << 456 << std::endl;
-         
-         log_density[j] = log_dens[0] + log(pj);
-         //Rcout << log_density[j] << std::endl;
-       }
-     }
-     //density = set_tol(density, tol);
-     log_density = log_density - max(log_density);
-     NumericVector density = exp(log_density) / sum(exp(log_density));
-     int selected = sample(seqC(0, y.nrow() - 1), 1, false, density)[0];
-     cluster[i] = selected;
-   }
-   
-    tau["cluster"] = cluster;
-   //Rcout << "complete update cluster probability" << std::endl;
-   //Rcout << "update sampling probability pi" << std::endl;
-    
-    //Rcout << "update table count" << std::endl;
-    IntegerVector nk = table(cluster);
-    for(int i = 0; i < y.nrow(); ++i){
-      std::string n_str = std::to_string(i);
-      const char *n = n_str.c_str();
-      if(!nk.containsElementNamed(n)){
-        nk[n] = 0;
-      }
+  int p = s.p;
+  long K = s.K();
+  const double* x = X.begin();
+  double sigma = s.sigma;
+  
+  // log N(x | y_h, Sigma) from one Cholesky factor L of Sigma (sigma in the
+  // univariate case)
+  std::vector<double> L_Sigma, half_q(K);
+  if(s.univariate){
+    L_Sigma.assign(1, sigma);
+  }else{
+    L_Sigma.assign(s.Sigma.begin(), s.Sigma.end());
+    if(!re_chol(L_Sigma.data(), p))
+      stop("update_DP_normal: Sigma is not positive definite");
+  }
+  double log_norm = -p * std::log(2 * M_PI) / 2;
+  for(int a = 0; a < p; ++a)
+    log_norm -= std::log(L_Sigma[a + a * p]);
+  
+  if(s.univariate){
+    double ss = 0;
+    for(long h = 0; h < K; ++h)
+      ss += (s.y(h, 0) - s.mu[0]) * (s.y(h, 0) - s.mu[0]);
+    s.lambda = rinvgamma((K * p) / 2 + s.a, s.b + ss / 2 / pow(sigma, 2));
+  }else{
+    re_half_quadratic(s.mu.memptr(), s.y.memptr(), K, L_Sigma.data(), p, half_q.data());
+    double q = 0;
+    for(long h = 0; h < K; ++h)
+      q += 2 * half_q[h];
+    s.lambda = rinvgamma((K * p) / 2 + s.a, s.b + q / 2);
+  }
+  double lambda = s.lambda;
+  
+  // assignments: with the whitened atoms w_h = L^-1 y_h and u = L^-1 x,
+  // log pi_h + log N(x | y_h, Sigma) = log pi_h + log_norm - |u - w_h|^2 / 2.
+  // The atoms are stored in the order of rank, by decreasing weight for the
+  // slice sampler so that the atoms above a slice are a prefix. In one
+  // dimension without the slice sampler only a window of atoms around each
+  // sample is weighed.
+  if(s.univariate && !slice){
+    dp_assign_univariate(x, N, s, sigma, nthreads);
+  }else{
+    std::vector<long> rank(K);
+    for(long h = 0; h < K; ++h)
+      rank[h] = h;
+    if(slice)
+      std::stable_sort(rank.begin(), rank.end(), [&s](long g, long h){return s.pi[g] > s.pi[h];});
+    std::vector<double> w_atoms(K * p), log_w0(K), u(p), pi_sorted(K);
+    for(long r = 0; r < K; ++r){
+      long h = rank[r];
+      for(int a = 0; a < p; ++a)
+        u[a] = s.y(h, a);
+      re_solve_lower(L_Sigma.data(), u.data(), p);
+      for(int a = 0; a < p; ++a)
+        w_atoms[r + a * K] = u[a];
+      pi_sorted[r] = s.pi[h];
+      log_w0[r] = slice ? log_norm : log_norm + log(s.pi[h]);
     }
-    
-    
-    CharacterVector p_names = rownames(y);
-    nk = nk[p_names];
-    
-    //Rcout << "update beta" << std::endl;
-    NumericMatrix beta(nk.length() - 1, 2);
-    beta(_,0) = as<NumericVector>(nk[seqC(0, (nk.length() - 2))]);
-    IntegerVector rev_nk = rev(nk);
-    
-    IntegerVector rev_cumsum = cumsum(rev_nk);
-    IntegerVector non_rev_cumsum = rev(rev_cumsum);
-    beta(_,1) = as<NumericVector>(non_rev_cumsum[seqC(1, (nk.length() - 1))]);
-    NumericVector Vh(nk.length() - 1);
-    for(int i = 0; i < nk.length() - 1; ++i){
-      double new_beta_sample = R::rbeta(1 + beta(i, 0), M + beta(i, 1));
-      int beta_count = 0;
-      while(new_beta_sample == 1.0 && beta_count < 10){
-        //Rcout <<"beta_count:" << beta_count << std::endl;
-        beta_count += 1;
-        new_beta_sample = R::rbeta(1 + beta(i, 0), M + beta(i, 1));
+    dp_for_blocks(N, nthreads, [&](long begin, long end, rn& gen){
+      std::vector<double> log_w(K), work(K), u(p);
+      for(long i = begin; i < end; ++i){
+        long K_i = K;
+        if(slice){
+          double u_i = gen.uniform() * s.pi[s.cluster[i]];
+          K_i = std::upper_bound(pi_sorted.begin(), pi_sorted.end(), u_i, std::greater<double>()) - pi_sorted.begin();
+        }
+        for(int a = 0; a < p; ++a)
+          u[a] = x[i + a * N];
+        re_solve_lower(L_Sigma.data(), u.data(), p);
+        double* lw = log_w.data();
+        std::copy(log_w0.begin(), log_w0.begin() + K_i, lw);
+        for(int a = 0; a < p; ++a){
+          const double ua = u[a];
+          const double* wa = &w_atoms[a * K];
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+          for(long h = 0; h < K_i; ++h){
+            double r = ua - wa[h];
+            lw[h] -= r * r / 2;
+          }
+        }
+        s.cluster[i] = rank[dp_sample_log_weights(lw, K_i, work.data(), gen.uniform())];
       }
-      if(beta_count >= 10)
-        new_beta_sample = (1 + beta(i, 0)) / (1 + beta(i, 0) + M + beta(i, 1));
-      Vh[i] = new_beta_sample;
+    });
+  }
+  
+  // count, mean and scatter about the mean (p x p, column major at
+  // scatter[h * p * p]) of the samples on each atom, in one pass by Welford's
+  // updates; the atoms and the kernel (co)variance only read these
+  s.nk.assign(K, 0);
+  arma::mat means(K, p, fill::zeros);
+  std::vector<double> scatter(K * p * p, 0), delta(p);
+  for(long i = 0; i < N; ++i){
+    int h = s.cluster[i];
+    double n_h = ++s.nk[h];
+    for(int a = 0; a < p; ++a){
+      delta[a] = x[i + a * N] - means(h, a);
+      means(h, a) += delta[a] / n_h;
     }
-    Vh.push_back(1);
-    //Rcout << "finish update beta" << std::endl;
-    
-    //Rcout << "update pi" << std::endl;
-    pi = NumericVector(nk.length());
-    pi[0] = Vh[0];
-    NumericVector log_negative_1_cumsum = cumsum(log(1 - Vh));
-    //Rcout << negative_1_cumprod << std::endl;
-    for(int i = 1; i < nk.length() - 1; ++i){
-      pi[i] = Vh[i] * exp(log_negative_1_cumsum[i - 1]);
+    double* S = &scatter[h * p * p];
+    for(int b = 0; b < p; ++b){
+      double e = x[i + b * N] - means(h, b);
+      for(int a = 0; a < p; ++a)
+        S[a + b * p] += delta[a] * e;
     }
-    
-    if (nk.length() > 1){
-      //Rcout << "nk>1" << std::endl;
-      pi[nk.length() - 1] = exp(log_negative_1_cumsum[nk.length() - 2]);
-      M = as<NumericVector>(rtgamma(1, nk.length() - 1, -1 / log_negative_1_cumsum[nk.length() - 2], pow(N, L), pow(N, U)))[0];
-    }else{
-      pi[0] = 1;
-      M = 0;
+  }
+  
+  // stick-breaking weights and M
+  std::vector<double> Vh(K);
+  long rest = N;
+  for(long h = 0; h < K - 1; ++h){
+    rest -= s.nk[h];
+    double new_beta_sample = R::rbeta(1 + s.nk[h], s.M + rest);
+    int beta_count = 0;
+    while(new_beta_sample == 1.0 && beta_count < 10){
+      beta_count += 1;
+      new_beta_sample = R::rbeta(1 + s.nk[h], s.M + rest);
     }
-    pi.names() = p_names;
-    //Rcout << "complete update sampling probability pi" << std::endl;
-    
-    //return List::create(Named("Vh") = Vh, Named("nk") = nk, Named("pi") = pi);
-    //Rcout << 123 << std::endl;
-    //Rcout << p << std::endl;
-    if(parameters.containsElementNamed("sd")){
-      //Rcout << "update cluster mean" << std::endl;
-      for(int i = 0 ; i < y.nrow(); ++i){
-        if(nk[i] == 0){
-          double var = std::pow(sigma, 2) * lambda;
-          double mean = parameters["mu"];
-          
-          double sample = rnorm(1, mean, sqrt(var))[0];
-          //return List::create(Named("mean") = mean, Named("var") = var, Named("s") = sample);
-          y(i,0) = sample;
-          //a(i, 0) = mean;
-          //a(i, 1) = var;
-        }else{
-          
-          //Rcout << inv_sigma << std::endl;
-          double var = std::pow(sigma, 2) * lambda / (lambda * nk[i] + 1);
-          //return List::create(Named("var") = var, Named("parameters") = parameters, Named("inv_sigma") = inv_sigma, Named("nk")=nk);
-          LogicalVector cluster_index = (cluster == i);
-          double mean = (lambda * colSums(row_matrix(X, cluster_index))[0] + as<double>(parameters["mu"])) / (lambda * nk[i] + 1);
-          
-          double sample = rnorm(1, mean, sqrt(var))[0];
-          //return List::create(Named("mean") = mean, Named("var") = var, Named("s") = sample);
-          y(i,0) = sample;
-          
-          //a(i, 0) = mean;
-          //a(i, 1) = var;
-        }
-        
-      }
-      //Rcout << "complete update cluster mean" << std::endl;
-      //Rcout << 123 << std::endl;
-      // dreturn List::create(Named("a") = a,Named("y") = y, Named("nk") = nk, Named("pi") = pi);
+    if(beta_count >= 10)
+      new_beta_sample = (1.0 + s.nk[h]) / (1 + s.nk[h] + s.M + rest);
+    Vh[h] = new_beta_sample;
+  }
+  Vh[K - 1] = 1;
+  s.pi[0] = Vh[0];
+  double log_negative_1_cumsum = 0;
+  for(long h = 1; h < K; ++h){
+    log_negative_1_cumsum += log(1 - Vh[h - 1]);
+    s.pi[h] = h < K - 1 ? Vh[h] * exp(log_negative_1_cumsum) : exp(log_negative_1_cumsum);
+  }
+  if(K > 1){
+    s.M = as<NumericVector>(rtgamma(1, K - 1, -1 / log_negative_1_cumsum, pow(N, L), pow(N, U)))[0];
+  }else{
+    s.pi[0] = 1;
+    s.M = 0;
+  }
+  
+  // atoms
+  for(long h = 0; h < K; ++h){
+    double shrink = lambda / (lambda * s.nk[h] + 1);
+    if(s.univariate){
+      double var = std::pow(sigma, 2) * shrink;
+      double mean = (lambda * s.nk[h] * means(h, 0) + s.mu[0]) / (lambda * s.nk[h] + 1);
+      s.y(h, 0) = R::rnorm(mean, sqrt(var));
     }else{
-      //Rcout << y << std::endl;
-      //NumericMatrix inv_sigma = solve(Sigma);
-      //Rcout << "update cluster mean" << std::endl;
-      for(int i = 0 ; i < y.nrow(); ++i){
-        //Rcout <<i << " "<< nk[i] << std::endl;
-        if(nk[i] == 0){
-          //Rcout <<i << " "<< nk[i] << std::endl;
-          NumericMatrix var = Sigma;
-          NumericVector mean = parameters["mu"];
-          NumericMatrix r_sample = wrap(rmvnorm(1, mean, lambda * as<mat>(var)));
-          //NumericVector sample = (0, _);
-          y(i,_) = r_sample(0, _);
-        }else{
-          //Rcout <<i << " "<< nk[i] << std::endl;
-          //Rcout << inv_sigma << std::endl;
-          NumericMatrix var = matrix_mul_scalar(Sigma, lambda / (lambda * nk[i] + 1));
-          //NumericMatrix var = solve_pos_def(matrix_add(as<NumericMatrix>(parameters["inv_Sigma"]), matrix_mul_scalar(inv_sigma, nk[i])));
-          //Rcout << var << std::endl;
-          //var = make_symmetric(var);
-          //return List::create(Named("var") = var, Named("parameters") = parameters, Named("inv_sigma") = inv_sigma, Named("nk")=nk);
-          LogicalVector cluster_index = (cluster == i);
-          //NumericMatrix sums_b_h = NumericMatrix(1, var.nrow(), colSums(row_matrix(X, cluster_index)).begin());
-          NumericVector sums_b_h = colSums(row_matrix(X, cluster_index));
-          
-          NumericVector mean = (sums_b_h * lambda + as<NumericVector>(parameters["mu"])) / (lambda * nk[i] + 1);
-            
-            
-          //NumericMatrix mu_par = NumericMatrix(1, var.nrow(), as<NumericVector>(parameters["mu"]).begin());
-          //NumericVector mean = matrix_mul_scalar(Sigma, lambda / (lambda * nk[i] + 1));
-          //NumericVector mean = matrix_multiply(matrix_add(matrix_multiply(sums_b_h, inv_sigma), matrix_multiply(mu_par, parameters["inv_Sigma"])), var);
-          //NumericVector mean = matrix_multiply(matrix_add(matrix_multiply(sums_b_h, inv_sigma), matrix_multiply(mu_par, parameters["inv_Sigma"])), var);
-          //var = solve(solve(tau$parameters$sigma) + nk[h] * solve(sigma))
-          //mean = (colSums(X[tau$cluster == h,, drop = FALSE]) %*% solve(sigma) + tau$parameters$mu %*% solve(tau$parameters$sigma)) %*% var
-          //return List::create(Named("rows") = colSums(row_matrix(X, cluster_index)), Named("inv_sigma") = inv_sigma, Named("mean") = mean, Named("var") = var, Named("parameters") = parameters);
-          //Rcout << mean << var << std::endl;
-          
-          
-          NumericMatrix r_sample = wrap(rmvnorm(1, mean, as<mat>(var)));
-          //NumericVector sample = (0, _);
-          y(i,_) = r_sample(0, _);
-          
-          //NumericVector neab = matrix_multiply(matrix_multiply(colSums(row_matrix(X, cluster_index)), inv_sigma) + matrix_multiply(parameters["mu"], parameters["inv_sigma"]), var);
-        }
-        
-        //NumericVector sample = rmvnorm(1, mean, var);
-        //y(i,_) = sample;
-      }
-      //Rcout << "complete update cluster mean" << std::endl;
+      arma::vec mean = (means.row(h).t() * (lambda * s.nk[h]) + s.mu) / (lambda * s.nk[h] + 1);
+      s.y.row(h) = rmvnorm(1, mean, s.Sigma * shrink);
     }
-    
-    
-    //Rcout << "update centralization" << std::endl;
-    if(CDP == true){
-      for(int i = 0; i < p; ++i){
-        y (_,i) = y (_,i) - sum(y(_,i) * pi);
-      }
+  }
+  if(s.CDP == true){
+    for(int a = 0; a < p; ++a){
+      double centre = 0;
+      for(long h = 0; h < K; ++h)
+        centre += s.y(h, a) * s.pi[h];
+      s.y.col(a) -= centre;
     }
-    //return List::create();
-    NumericMatrix samples(N, p);
-    for(int i = 0; i < N; ++i){
-      samples(i,_) = y(cluster[i], _);
+  }
+  s.samples.set_size(N, p);
+  for(long i = 0; i < N; ++i)
+    s.samples.row(i) = s.y.row(s.cluster[i]);
+  
+  // kernel (co)variance; the samples on atom h have
+  // sum_i (x_i - y_h)(x_i - y_h)' = scatter_h + n_h (mean_h - y_h)(mean_h - y_h)'
+  if(s.univariate){
+    double rss = 0, ss = 0;
+    for(long h = 0; h < K; ++h){
+      double e = means(h, 0) - s.y(h, 0);
+      rss += scatter[h] + s.nk[h] * e * e;
+      ss += (s.y(h, 0) - s.mu[0]) * (s.y(h, 0) - s.mu[0]);
     }
-    
-    //Rcout << "complete update centralization" << std::endl;
-    
-    tau["pi"] = pi;
-    tau["M"] = M;
-    tau["y"] = y;
-    tau["cluster"] = cluster;
-    tau["samples"] = samples;
-    tau["lambda"] = lambda;
-    parameters["lambda"] = lambda;
-    
-    //Rcout << "update Sigma/sigma" << std::endl;
-    
-    if(parameters.containsElementNamed("sd")){
-      double v = parameters["v"];
-      double k = parameters["k"];
-      NumericVector X_ = X(_, 0);
-      NumericVector samples_ = samples(_, 0);
-      NumericVector y_ = y(_, 0);
-      tau["sigma"] = sqrt(rinvgamma((N + v + y.length()) / 2, (k*v + innerProduct(X_ - samples_, X_ - samples_) + innerProduct(y_ - as<double>(parameters["mu"]), y_ - as<double>(parameters["mu"])) / lambda)/2));
-      parameters["sigma"] = tau["sigma"];
-      //parameters["inv_sigma_2"] = 1 / pow(as<double>(tau["sigma"]), 2);
-    }else{
-      NumericMatrix Psi = parameters["Psi"];
-      double d = parameters["d"];
-      NumericMatrix X_diff_musi = matrix_add(X, matrix_mul_scalar(samples, -1));
-      NumericMatrix B_B_A = matrix_multiply(transpose(X_diff_musi), X_diff_musi);
-      //Rcout << B_B_A << std::endl;
-      NumericVector mu0 = parameters["mu"];
-      
-      NumericMatrix musi_diff_mu0 = wrap(as<arma::mat>(y).each_row() - as<arma::rowvec>(mu0));
-      //Rcout << y << std::endl;
-      //Rcout << musi_diff_mu0 << std::endl;
-      NumericMatrix mu_mu_A = matrix_multiply(transpose(musi_diff_mu0), musi_diff_mu0);
-      //Rcout <<  mu_mu_A << std::endl;
-      mu_mu_A = matrix_mul_scalar(mu_mu_A, 1 / lambda);
-      //Rcout <<  mu_mu_A << std::endl;
-      NumericMatrix Iwish_para = matrix_add(matrix_add(Psi, B_B_A), mu_mu_A);
-      //Rcout << Iwish_para << std::endl;
-      //Rcout << d + N + y.nrow() << std::endl;
-      //Rcout << matrix_mul_scalar(Iwish_para, 1 / (d + N + y.nrow() - 4)) << std::endl;
-      NumericMatrix covariance = wrap(riwishArma(d + N + y.nrow(), as<arma::mat>(Iwish_para)));
-      tau["Sigma"] = covariance;
-      parameters["Sigma"] = covariance;
-      //parameters["inv_Sigma"] = solve_pos_def(covariance);
+    s.sigma = sqrt(rinvgamma((N + s.v + K) / 2, (s.k * s.v + rss + ss / lambda) / 2));
+  }else{
+    // Psi + (X - samples)'(X - samples) + (y - mu)'(y - mu) / lambda
+    arma::mat Iwish_para = s.Psi;
+    for(long h = 0; h < K; ++h){
+      const double* S = &scatter[h * p * p];
+      for(int a = 0; a < p; ++a)
+        delta[a] = means(h, a) - s.y(h, a);
+      for(int b = 0; b < p; ++b)
+        for(int a = 0; a < p; ++a)
+          Iwish_para(a, b) += S[a + b * p] + s.nk[h] * delta[a] * delta[b] + (s.y(h, a) - s.mu[a]) * (s.y(h, b) - s.mu[b]) / lambda;
     }
-    //Rcout << "complete update Sigma/sigma" << std::endl;
-    tau["parameters"] = parameters;
-    return tau;
+    s.Sigma = riwishArma(s.d + N + K, Iwish_para);
   }
-  return tau;
-}
\ No newline at end of file
+}
+
+// [[Rcpp::export]]
+List DP(List parameters, double M, long N_truncated, long N_sample, bool CDP = true){
+  return dp_to_list(dp_init(parameters, M, N_truncated, N_sample, CDP));
+}
+
+// [[Rcpp::export]]
+List update_DP_normal(NumericMatrix X, List tau, double L = -1, double U = 2, bool slice = false){
+  dp_state s = dp_from_list(tau);
+  dp_update_normal(X, s, L, U, slice);
+  return dp_to_list(s);
+}
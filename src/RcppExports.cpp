@@ -27,8 +27,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // update_DP_normal
-List update_DP_normal(NumericMatrix X, List tau, double L, double U);
-RcppExport SEXP _SBMTrees_update_DP_normal(SEXP XSEXP, SEXP tauSEXP, SEXP LSEXP, SEXP USEXP) {
+List update_DP_normal(NumericMatrix X, List tau, double L, double U, bool slice);
+RcppExport SEXP _SBMTrees_update_DP_normal(SEXP XSEXP, SEXP tauSEXP, SEXP LSEXP, SEXP USEXP, SEXP sliceSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -36,7 +36,8 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< List >::type tau(tauSEXP);
     Rcpp::traits::input_parameter< double >::type L(LSEXP);
     Rcpp::traits::input_parameter< double >::type U(USEXP);
-    rcpp_result_gen = Rcpp::wrap(update_DP_normal(X, tau, L, U));
+    Rcpp::traits::input_parameter< bool >::type slice(sliceSEXP);
+    rcpp_result_gen = Rcpp::wrap(update_DP_normal(X, tau, L, U, slice));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -68,8 +69,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // sequential_imputation_cpp
-List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool binary_outcome, int nburn, int npost, int skip, bool verbose, bool CDP_residual, bool CDP_re, Nullable<long> seed, double tol, int ncores, int ntrees, bool fit_loss, int resample, double pi_CDP);
-RcppExport SEXP _SBMTrees_sequential_imputation_cpp(SEXP XSEXP, SEXP YSEXP, SEXP typeSEXP, SEXP ZSEXP, SEXP subject_idSEXP, SEXP RSEXP, SEXP binary_outcomeSEXP, SEXP nburnSEXP, SEXP npostSEXP, SEXP skipSEXP, SEXP verboseSEXP, SEXP CDP_residualSEXP, SEXP CDP_reSEXP, SEXP seedSEXP, SEXP tolSEXP, SEXP ncoresSEXP, SEXP ntreesSEXP, SEXP fit_lossSEXP, SEXP resampleSEXP, SEXP pi_CDPSEXP) {
+List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool binary_outcome, int nburn, int npost, int skip, bool verbose, bool CDP_residual, bool CDP_re, Nullable<long> seed, double tol, int ncores, int ntrees, bool fit_loss, int resample, double pi_CDP, int nchains, bool dp_slice, bool single_precision);
+RcppExport SEXP _SBMTrees_sequential_imputation_cpp(SEXP XSEXP, SEXP YSEXP, SEXP typeSEXP, SEXP ZSEXP, SEXP subject_idSEXP, SEXP RSEXP, SEXP binary_outcomeSEXP, SEXP nburnSEXP, SEXP npostSEXP, SEXP skipSEXP, SEXP verboseSEXP, SEXP CDP_residualSEXP, SEXP CDP_reSEXP, SEXP seedSEXP, SEXP tolSEXP, SEXP ncoresSEXP, SEXP ntreesSEXP, SEXP fit_lossSEXP, SEXP resampleSEXP, SEXP pi_CDPSEXP, SEXP nchainsSEXP, SEXP dp_sliceSEXP, SEXP single_precisionSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -93,13 +94,16 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< bool >::type fit_loss(fit_lossSEXP);
     Rcpp::traits::input_parameter< int >::type resample(resampleSEXP);
     Rcpp::traits::input_parameter< double >::type pi_CDP(pi_CDPSEXP);
-    rcpp_result_gen = Rcpp::wrap(sequential_imputation_cpp(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, CDP_residual, CDP_re, seed, tol, ncores, ntrees, fit_loss, resample, pi_CDP));
+    Rcpp::traits::input_parameter< int >::type nchains(nchainsSEXP);
+    Rcpp::traits::input_parameter< bool >::type dp_slice(dp_sliceSEXP);
+    Rcpp::traits::input_parameter< bool >::type single_precision(single_precisionSEXP);
+    rcpp_result_gen = Rcpp::wrap(sequential_imputation_cpp(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, CDP_residual, CDP_re, seed, tol, ncores, ntrees, fit_loss, resample, pi_CDP, nchains, dp_slice, single_precision));
     return rcpp_result_gen;
 END_RCPP
 }
 // BMTrees_mcmc
-List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, CharacterVector subject_id, LogicalVector obs_ind, bool binary, long nburn, long npost, bool verbose, bool CDP_residual, bool CDP_re, Nullable<long> seed, double tol, long ntrees, int resample, double pi_CDP);
-RcppExport SEXP _SBMTrees_BMTrees_mcmc(SEXP XSEXP, SEXP YSEXP, SEXP ZSEXP, SEXP subject_idSEXP, SEXP obs_indSEXP, SEXP binarySEXP, SEXP nburnSEXP, SEXP npostSEXP, SEXP verboseSEXP, SEXP CDP_residualSEXP, SEXP CDP_reSEXP, SEXP seedSEXP, SEXP tolSEXP, SEXP ntreesSEXP, SEXP resampleSEXP, SEXP pi_CDPSEXP) {
+List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, CharacterVector subject_id, LogicalVector obs_ind, bool binary, long nburn, long npost, bool verbose, bool CDP_residual, bool CDP_re, Nullable<long> seed, double tol, long ntrees, int resample, double pi_CDP, bool dp_slice, bool single_precision, int ncores);
+RcppExport SEXP _SBMTrees_BMTrees_mcmc(SEXP XSEXP, SEXP YSEXP, SEXP ZSEXP, SEXP subject_idSEXP, SEXP obs_indSEXP, SEXP binarySEXP, SEXP nburnSEXP, SEXP npostSEXP, SEXP verboseSEXP, SEXP CDP_residualSEXP, SEXP CDP_reSEXP, SEXP seedSEXP, SEXP tolSEXP, SEXP ntreesSEXP, SEXP resampleSEXP, SEXP pi_CDPSEXP, SEXP dp_sliceSEXP, SEXP single_precisionSEXP, SEXP ncoresSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -119,7 +123,10 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< long >::type ntrees(ntreesSEXP);
     Rcpp::traits::input_parameter< int >::type resample(resampleSEXP);
     Rcpp::traits::input_parameter< double >::type pi_CDP(pi_CDPSEXP);
-    rcpp_result_gen = Rcpp::wrap(BMTrees_mcmc(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, CDP_residual, CDP_re, seed, tol, ntrees, resample, pi_CDP));
+    Rcpp::traits::input_parameter< bool >::type dp_slice(dp_sliceSEXP);
+    Rcpp::traits::input_parameter< bool >::type single_precision(single_precisionSEXP);
+    Rcpp::traits::input_parameter< int >::type ncores(ncoresSEXP);
+    rcpp_result_gen = Rcpp::wrap(BMTrees_mcmc(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, CDP_residual, CDP_re, seed, tol, ntrees, resample, pi_CDP, dp_slice, single_precision, ncores));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -628,11 +635,11 @@ END_RCPP
 
 static const R_CallMethodDef CallEntries[] = {
     {"_SBMTrees_DP", (DL_FUNC) &_SBMTrees_DP, 5},
-    {"_SBMTrees_update_DP_normal", (DL_FUNC) &_SBMTrees_update_DP_normal, 4},
+    {"_SBMTrees_update_DP_normal", (DL_FUNC) &_SBMTrees_update_DP_normal, 5},
     {"_SBMTrees_DP_sampler", (DL_FUNC) &_SBMTrees_DP_sampler, 2},
     {"_SBMTrees_bart_train", (DL_FUNC) &_SBMTrees_bart_train, 5},
-    {"_SBMTrees_sequential_imputation_cpp", (DL_FUNC) &_SBMTrees_sequential_imputation_cpp, 20},
-    {"_SBMTrees_BMTrees_mcmc", (DL_FUNC) &_SBMTrees_BMTrees_mcmc, 16},
+    {"_SBMTrees_sequential_imputation_cpp", (DL_FUNC) &_SBMTrees_sequential_imputation_cpp, 23},
+    {"_SBMTrees_BMTrees_mcmc", (DL_FUNC) &_SBMTrees_BMTrees_mcmc, 19},
     {"_SBMTrees_update_Covariance", (DL_FUNC) &_SBMTrees_update_Covariance, 5},
     {"_SBMTrees_max_d", (DL_FUNC) &_SBMTrees_max_d, 2},
     {"_SBMTrees_seqD", (DL_FUNC) &_SBMTrees_seqD, 3},
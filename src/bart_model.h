@@ -44,6 +44,8 @@
 #include "BART/bart.h"
 #include<stdio.h>
 #include "BART/cpwbart.h"
+#include "BART/ensemble.h"
+#include "BART/cutpoints.h"
 
 #endif
 #ifndef RCPP_H_
@@ -55,8 +57,6 @@
 using namespace Rcpp;
 
 
-#define TRDRAW(a, b) trdraw(a, b)
-
 class bart_model{
 public:
   bart_model(){};
@@ -65,23 +65,48 @@ public:
     //Rcout << 123 << std::endl;
     //G = Rcpp::Environment::global_env();
     //Rcout << 123 << std::endl;
-    Function bartModelMatrix = Environment::namespace_env("SBMTrees")["bartModelMatrix"];
-    //Rcout << 123 << std::endl;
     this->usequants = usequants;
     this->cont = cont;
     this->rm_const = rm_const;
     this->alpha = base;
     this->mybeta = power;
     this->tree_object = List();
+    collected = false;
     sigma = 1;
     this->nu = nu;
     
     n = y_train.length();
-    Rcpp::List temp = bartModelMatrix(clone(x_train), numcut, usequants, 7, rm_const, cont);
-    NumericMatrix X = transpose(as<NumericMatrix>(temp["X"]));
-    
-    this->numcut = as<IntegerVector>(temp["numcut"]);
-    NumericMatrix Xinfo = as<NumericMatrix>(temp["xinfo"]);
+    // cutpoints as bartModelMatrix(x_train, numcut, usequants, 7, rm_const, cont)
+    xinfo xi_;
+    std::vector<int> nc_, rm_;
+    makecuts_bart(x_train.nrow(), x_train.ncol(), x_train.begin(), numcut, usequants, cont, xi_, nc_, rm_);
+    NumericMatrix X;
+    if(rm_const && rm_.size() > 0 && rm_.size() < (size_t)x_train.ncol()){
+      // drop the constant columns
+      std::vector<int> keep;
+      for(int j = 0, r = 0; j < x_train.ncol(); ++j){
+        if(r < (int)rm_.size() && rm_[r] == -(j + 1)) ++r;
+        else keep.push_back(j);
+      }
+      X = NumericMatrix(keep.size(), x_train.nrow());
+      xinfo xk(keep.size());
+      std::vector<int> nk(keep.size());
+      for(size_t j = 0; j < keep.size(); ++j){
+        X(j, _) = x_train(_, keep[j]);
+        xk[j] = xi_[keep[j]];
+        nk[j] = nc_[keep[j]];
+      }
+      xi_ = xk;
+      nc_ = nk;
+    }else{
+      X = transpose(x_train);
+      if(rm_.size() == 0 || rm_.size() == (size_t)x_train.ncol()){
+        rm_.clear();
+        for(int j = 0; j < x_train.ncol(); ++j) rm_.push_back(j + 1);
+      }
+    }
+    this->numcut = IntegerVector(nc_.begin(), nc_.end());
+    this->rm_const = IntegerVector(rm_.begin(), rm_.end());
     
     //Rcout << 123 << std::endl;
     //Rcout << "bartModelMatrix" << std::endl;
@@ -137,22 +162,15 @@ public:
     
     bm = bart(ntrees);
     
-    if(Xinfo.size()>0) {
-      xinfo xi_;
-      xi_.resize(p);
-      for(size_t i=0;i<p;i++) {
-        xi_[i].resize(this->numcut[i]);
-        //Rcpp::IntegerVector cutpts(Xinfo[i]);
-        for(size_t j=0;j<(size_t)this->numcut[i];j++) xi_[i][j]=Xinfo(i, j);
-      }
-      bm.setxinfo(xi_);
-    }
+    bm.setxinfo(xi_);
     
-    Rcpp::NumericVector  xv(X);
+    xv.assign(X.begin(), X.end());
     ix = &xv[0];
-    Rcpp::NumericVector  yv(y); 
+    yv.assign(y.begin(), y.end());
     iy = &yv[0];
     int *nc = &this->numcut[0];
+    // every model owns its stream, seeded from the R RNG so set.seed() still applies
+    gen.set_seed((unsigned int)(R::unif_rand() * 4294967295.0));
     
     
     //heterbart bm(m);
@@ -162,192 +180,55 @@ public:
   };
  
   List update(long nburn, long npost, int skip, bool verbose = false, long print_every = 100L){
-    Rcpp::NumericVector trmean(n); //train
-    Rcpp::NumericVector tsigma(0); //train
-    Rcpp::NumericMatrix trdraw(npost / skip,n);
-    Rcpp::NumericMatrix varprb(npost / skip,p);
-    Rcpp::IntegerMatrix varcnt(npost / skip,p);
-    
-    std::stringstream treess;  //string stream to write trees to  
-    treess.precision(10);
-    treess << npost / skip << " " << ntrees << " " << p << endl;
-    std::vector<double> ivarprb (p,0.);
-    std::vector<size_t> ivarcnt (p,0);
-    
-    
-    if(verbose)
-      printf("\nMCMC\n");
-    size_t trcnt=0;
-    size_t treedrawscnt=0; //count kept bart draws
-    bool keeptreedraw;
-    xinfo& xi = bm.getxinfo();
-    //Rcout << "sigma:" << this->sigma<<std::endl;
-    for(int i=0; i < nburn + npost;i++) {
-      if(verbose){
-        if(i % print_every == 0){
-          printf("iteration %d",i);
-          Rcout << "/"<<nburn + npost <<std::endl;
-        }
-        
-        
-      }
-      //draw bart
-      //Rcout << "before draw" << std::endl;
-      bm.draw(sigma,gen);
-      //Rcout << "after draw" << std::endl;
-      double restemp = 0, rss=0.0;
-      for(size_t k=0;k<n;k++) {restemp=(iy[k]-bm.f(k)); rss += restemp*restemp;}
-      //Rcout << "rss:" << rss << std::endl;
-      sigma = sqrt((nu*lambda + rss)/gen.chi_square(n+nu));
-      
-      if(i>=nburn) {
-        for(size_t k=0;k<n;k++) trmean[k]+=bm.f(k);
-        keeptreedraw = npost && (((i-nburn+1) % skip) ==0);
-        if(keeptreedraw) {
-          //Rcout << sigma << std::endl;
-          tsigma.push_back(sigma);
-          for(long k=0;k<n;k++) TRDRAW(trcnt,k)=bm.f(k);
-          trcnt+=1;
-          for(size_t j=0;j<ntrees;j++) {
-            treess << bm.gettree(j);
-          }
-#ifndef NoRcpp
-          ivarcnt=bm.getnv();
-          ivarprb=bm.getpv();
-          size_t k=(i-nburn)/skip;
-          for(size_t j=0;j<p;j++){
-            varcnt(k,j)=ivarcnt[j];
-            //varcnt(i-burn,j)=ivarcnt[j];
-            varprb(k,j)=ivarprb[j];
-            //varprb(i-burn,j)=ivarprb[j];
-          }
-#else
-          varcnt.push_back(bm.getnv());
-          varprb.push_back(bm.getpv());
-#endif
-          
-          treedrawscnt +=1;
-        }
-      }
-    }
-    if(verbose){
-      //printf("iteration %zu complete\n", nburn + npost);
-    }
-    for(size_t k=0;k<n;k++) trmean[k]/=npost;
-    
-#ifndef NoRcpp
-    Rcpp::List ret;
-    //ret["sigma"]=sdraw;
-    //Rcout << trmean << std::endl;
-    ret["yhat.train.mean"]=trmean;
-    ret["yhat.train"]=trdraw;
-    //ret["varcount"]=varcount;
-    ret["varcount"]=varcnt;
-    ret["varprob"]=varprb;
-    Rcpp::List xiret(xi.size());
-    for(size_t i=0;i<xi.size();i++) {
-      Rcpp::NumericVector vtemp(xi[i].size());
-      std::copy(xi[i].begin(),xi[i].end(),vtemp.begin());
-      xiret[i] = Rcpp::NumericVector(vtemp);
-    }
-    
-    Rcpp::List treesL;
-    treesL["cutpoints"] = xiret;
-    treesL["trees"]=Rcpp::CharacterVector(treess.str());
-    //   if(treesaslists) treesL["lists"]=list_of_lists;
-    ret["treedraws"] = treesL;
-    ret["mu"] = fmean;
-    ret["yhat.train.mean"] = trmean+fmean;
-    ret["yhat.train"] = trdraw+fmean;
-    ret["sigma"] = tsigma;
-    this->tree_object = ret;
-    return ret;
-#else
-    
-#endif
-    
-    
-    //return List::create();
+    mcmc(nburn, npost, skip, true, verbose, print_every);
+    return collect();
   };
   
   List update(double sigma, long nburn, long npost, int skip, bool verbose = false, long print_every = 100L){
     this->sigma = sigma;
-    Rcpp::NumericVector trmean(n); //train
-    Rcpp::NumericMatrix trdraw(npost / skip,n);
-    Rcpp::NumericMatrix varprb(npost / skip,p);
-    Rcpp::IntegerMatrix varcnt(npost / skip,p);
-    
+    mcmc(nburn, npost, skip, false, verbose, print_every);
+    return collect();
+  };
+  
+  // same as update(sigma, ...) but without touching R, so that several models
+  // can be drawn at the same time; collect() has to be called afterwards on
+  // the main thread
+  void draw(double sigma, long nburn, long npost, int skip){
+    this->sigma = sigma;
+    mcmc(nburn, npost, skip, false, false, 100L);
+  };
+  
+  // posterior mean of the fit at the training data over the last mcmc(),
+  // all the sampler needs after a draw
+  NumericVector fitted(){
+    NumericVector ret(n);
+    for(long k=0;k<n;k++) ret[k] = trmean[k] + fmean;
+    return ret;
+  }
+  
+  // wrap the draws of the last mcmc() into the cwbart-like list; the trees
+  // are only written out as text here
+  List collect(){
+    xinfo& xi = bm.getxinfo();
     std::stringstream treess;  //string stream to write trees to  
     treess.precision(10);
-    treess << npost / skip << " " << ntrees << " " << p << endl;
-    std::vector<double> ivarprb (p,0.);
-    std::vector<size_t> ivarcnt (p,0);
-    
-    
-    if(verbose)
-      printf("\nMCMC\n");
-    size_t trcnt=0;
-    size_t treedrawscnt=0; //count kept bart draws
-    bool keeptreedraw;
-    xinfo& xi = bm.getxinfo();
-    //Rcout << "sigma:" << this->sigma<<std::endl;
-    for(size_t i=0;i< nburn + npost;i++) {
-      if(verbose){
-        if(i % print_every == 0){
-          //printf("iteration %zu",i);
-          Rcout << "/"<<nburn + npost <<std::endl;
-        }
-        
-        
-      }
-      //draw bart
-      //Rcout << "before draw" << std::endl;
-      bm.draw(sigma,gen);
-      //Rcout << "after draw" << std::endl;
-      
-      if(i>=nburn) {
-        for(size_t k=0;k<n;k++) trmean[k]+=bm.f(k);
-        keeptreedraw = npost && (((i-nburn+1) % skip) ==0);
-        if(keeptreedraw) {
-          //Rcout << sigma << std::endl;
-          for(size_t k=0;k<n;k++) TRDRAW(trcnt,k)=bm.f(k);
-          trcnt+=1;
-          for(size_t j=0;j<ntrees;j++) {
-            treess << bm.gettree(j);
-          }
-#ifndef NoRcpp
-          ivarcnt=bm.getnv();
-          ivarprb=bm.getpv();
-          size_t k=(i-nburn)/skip;
-          for(size_t j=0;j<p;j++){
-            varcnt(k,j)=ivarcnt[j];
-            //varcnt(i-burn,j)=ivarcnt[j];
-            varprb(k,j)=ivarprb[j];
-            //varprb(i-burn,j)=ivarprb[j];
-          }
-#else
-          varcnt.push_back(bm.getnv());
-          varprb.push_back(bm.getpv());
-#endif
-          
-          treedrawscnt +=1;
-        }
+    ens.write(treess);
+    size_t ndraws = trcnt;
+    Rcpp::List ret;
+    Rcpp::NumericVector trmean_r(n);
+    Rcpp::NumericMatrix trdraw_r(ndraws, n);
+    Rcpp::NumericMatrix varprb_r(ndraws, p);
+    Rcpp::IntegerMatrix varcnt_r(ndraws, p);
+    for(long k=0;k<n;k++) trmean_r[k] = trmean[k] + fmean;
+    for(size_t i=0;i<ndraws;i++){
+      for(long k=0;k<n;k++) trdraw_r(i, k) = trdraw[i*n+k] + fmean;
+      for(long j=0;j<p;j++){
+        varcnt_r(i, j) = varcnt[i*p+j];
+        varprb_r(i, j) = varprb[i*p+j];
       }
     }
-    if(verbose){
-      //printf("iteration %zu complete\n", nburn + npost);
-    }
-    for(size_t k=0;k<n;k++) trmean[k]/=npost;
-    
-#ifndef NoRcpp
-    Rcpp::List ret;
-    //ret["sigma"]=sdraw;
-    //Rcout << trmean << std::endl;
-    ret["yhat.train.mean"]=trmean;
-    ret["yhat.train"]=trdraw;
-    //ret["varcount"]=varcount;
-    ret["varcount"]=varcnt;
-    ret["varprob"]=varprb;
+    ret["varcount"]=varcnt_r;
+    ret["varprob"]=varprb_r;
     Rcpp::List xiret(xi.size());
     for(size_t i=0;i<xi.size();i++) {
       Rcpp::NumericVector vtemp(xi[i].size());
@@ -361,72 +242,112 @@ public:
     //   if(treesaslists) treesL["lists"]=list_of_lists;
     ret["treedraws"] = treesL;
     ret["mu"] = fmean;
-    ret["yhat.train.mean"] = trmean+fmean;
-    ret["yhat.train"] = trdraw+fmean;
-    ret["sigma"] = sigma;
+    ret["yhat.train.mean"] = trmean_r;
+    ret["yhat.train"] = trdraw_r;
+    if(draw_sigma)
+      ret["sigma"] = Rcpp::NumericVector(tsigma.begin(), tsigma.end());
+    else
+      ret["sigma"] = sigma;
     this->tree_object = ret;
+    collected = true;
     return ret;
-#else
-    
-#endif
-    
-    
-    //return List::create();
   };
   
   
   void set_data(NumericMatrix x_train, NumericVector y_train){
     n = y_train.length();
-    //Function bartModelMatrix = G["bartModelMatrix"];
     this->fmean = mean(y_train);
-    NumericVector y = clone(y_train)-this->fmean;
-    //xinfo & xi = bm.getxinfo();
-    //long ncu = max(numcut);
-    //Rcpp::List temp = bartModelMatrix(clone(x_train), ncu, usequants, R_NilValue, rm_const, cont, xi);
-    
-    //setxinfo 
-    NumericMatrix X = transpose(clone(x_train));
-    //numcut = as<IntegerVector>(temp["numcut"]);
-    // //NumericMatrix X = transpose(x_train);
+    NumericMatrix X = transpose(x_train);
     p = X.nrow();
-    Rcpp::NumericVector  xv(X);
-    // free(ix);
-    // free(iy);
-    double * ix_new = &xv[0];
-    Rcpp::NumericVector  yv(y);
-    double * iy_new = &yv[0];
+    // keep our own copies, bm only holds pointers into them
+    xv.assign(X.begin(), X.end());
+    yv.resize(n);
+    for(long k=0;k<n;k++) yv[k] = y_train[k] - this->fmean;
+    ix = &xv[0];
+    iy = &yv[0];
     int *nc = &numcut[0];
-    bm.setdata(p,n,ix_new, iy_new, nc);
-    
-    
-    
-    //update(sigma, 1, 0, 1, false);
-    //delete [] ix;
-    //delete [] iy;
-    //ix = ix_new;
-    //iy = iy_new;
-    //bm.setdata(p,n,ix,iy, nc);
+    bm.setdata(p,n,ix,iy,nc);
   };
   
   NumericMatrix predict(NumericMatrix x_predict, bool verbose = false){
     //Function bartModelMatrix = G["bartModelMatrix"];
-    if(this->tree_object.length() == 0){
+    if(ens.getnd() == 0){
       return NumericMatrix();
     }
     //xinfo & xi = bm.getxinfo();
     //long ncu = max(numcut);
     //Rcpp::List temp = bartModelMatrix(clone(x_predict), ncu, usequants, R_NilValue, rm_const, cont, xi);
     NumericMatrix X = transpose(as<NumericMatrix>(clone(x_predict)));
-    //Rcout << xi << std::endl;
-    //return xi;
-    //return this->tree_object["treedraws"];
-    NumericMatrix predict_y = cpwbart(this->tree_object["treedraws"], X, verbose);
-    //Rcout << predict_y << std::endl;
-    //Rcout << "predict_Y" << std::endl;
+    //the kept draws are compiled into ens by mcmc(), no need to parse
+    //this->tree_object["treedraws"] with cpwbart any more
+    std::vector<unsigned short> xb(X.size());
+    for(size_t i = 0; i < xb.size(); ++i)
+      xb[i] = bm.getbin(i % p, X[i]);
+    NumericMatrix predict_y(ens.getnd(), X.ncol());
+    ens.predict(X.ncol(), xb.data(), predict_y.begin());
     return predict_y + this->fmean;
   };
   
+  // prediction cache for the imputation: keeps x_predict (binned), the fit
+  // of the current trees on it and, for every variable, the trees splitting
+  // on it, so that a change in one column only revisits those trees
+  void set_predict_cache(NumericMatrix x_predict){
+    cn = x_predict.nrow();
+    cx.resize(cn * p);
+    for(size_t i = 0; i < cn; ++i)
+      for(long j = 0; j < p; ++j)
+        cx[i * p + j] = bm.getbin(j, x_predict(i, j));
+    vtrees.assign(p, std::vector<size_t>());
+    std::vector<size_t> all(ntrees);
+    std::vector<bool> used(p);
+    for(size_t t = 0; t < (size_t)ntrees; ++t){
+      all[t] = t;
+      tree::npv nds;
+      bm.gettree(t).getnodes(nds);
+      std::fill(used.begin(), used.end(), false);
+      for(size_t k = 0; k < nds.size(); ++k)
+        if(nds[k]->getl()) used[nds[k]->getv()] = true;
+      for(long j = 0; j < p; ++j)
+        if(used[j]) vtrees[j].push_back(t);
+    }
+    cfit.resize(cn);
+    for(size_t i = 0; i < cn; ++i)
+      cfit[i] = fit_trees(all, &cx[i * p]);
+  }
+  
+  NumericVector predict_cached(){
+    if(cfit.size() == 0)
+      stop("The prediction cache has not been set.");
+    NumericVector ret(cn);
+    for(size_t i = 0; i < cn; ++i)
+      ret[i] = cfit[i] + this->fmean;
+    return ret;
+  }
+  
+  // cached predictions with column col set to x_col on the given rows
+  // (0-based, x_col is indexed by row); the cache itself is not changed
+  NumericVector predict_cached(int col, NumericVector x_col, IntegerVector rows){
+    NumericVector ret = predict_cached();
+    std::vector<unsigned short> xr(p);
+    for(int k = 0; k < rows.length(); ++k)
+      ret[rows[k]] += fit_change(col, x_col[rows[k]], rows[k], xr);
+    return ret;
+  }
+  
+  // write column col = x_col on the given rows into the cache
+  void update_predict_cache(int col, NumericVector x_col, IntegerVector rows){
+    if(cfit.size() != cn)
+      stop("The prediction cache has not been set.");
+    std::vector<unsigned short> xr(p);
+    for(int k = 0; k < rows.length(); ++k){
+      cfit[rows[k]] += fit_change(col, x_col[rows[k]], rows[k], xr);
+      cx[rows[k] * p + col] = bm.getbin(col, x_col[rows[k]]);
+    }
+  }
+  
   SEXP get_tree_object(){
+    if(!collected && ens.getnd() > 0)
+      collect();
     return tree_object;
   }
   
@@ -434,6 +355,22 @@ public:
     return this->sigma;
   }
   
+  // stream `stream` of the user seed instead of the draw from the R RNG
+  void set_seed(uint64_t seed, uint64_t stream){
+    gen.set_seed(seed, stream);
+  }
+  
+  // threads for the loops over the rows inside a draw of the trees
+  void set_threads(int nthreads){
+    bm.setnthreads(nthreads);
+  }
+  
+  // keep the residuals and the fit of the tree being drawn in float, the
+  // sums over them (and the fit of the ensemble) stay double
+  void set_single(bool single){
+    bm.setsingle(single);
+  }
+  
   bool get_usequants(){
     return this->usequants;
   }
@@ -452,6 +389,81 @@ public:
   
   
 private:
+  // sum of the given trees at the binned x
+  double fit_trees(const std::vector<size_t>& trees, const unsigned short *xb){
+    double f = 0.;
+    for(size_t k = 0; k < trees.size(); ++k)
+      f += bm.gettree(trees[k]).bnb(xb)->gettheta();
+    return f;
+  }
+  
+  // change of the fit of cached row r when its column col becomes x_new
+  double fit_change(int col, double x_new, size_t r, std::vector<unsigned short>& xr){
+    const std::vector<size_t>& trees = vtrees[col];
+    unsigned short b_new = bm.getbin(col, x_new);
+    if(trees.size() == 0 || cx[r * p + col] == b_new)
+      return 0.;
+    std::copy(cx.begin() + r * p, cx.begin() + (r + 1) * p, xr.begin());
+    double f_old = fit_trees(trees, &xr[0]);
+    xr[col] = b_new;
+    return fit_trees(trees, &xr[0]) - f_old;
+  }
+  
+  // nburn + npost draws of the ensemble, sigma is drawn as well if draw_sigma;
+  // plain C++ only, the kept draws are wrapped for R by collect()
+  void mcmc(long nburn, long npost, int skip, bool draw_sigma, bool verbose, long print_every){
+    this->draw_sigma = draw_sigma;
+    size_t nkeep = npost / skip;
+    trmean.assign(n, 0.);
+    trdraw.assign(nkeep * n, 0.);
+    varcnt.assign(nkeep * p, 0);
+    varprb.assign(nkeep * p, 0.);
+    tsigma.clear();
+    
+    ens.clear(ntrees, p);
+    collected = false;
+    
+    if(verbose)
+      printf("\nMCMC\n");
+    trcnt=0;
+    bool keeptreedraw;
+    for(long i=0; i < nburn + npost;i++) {
+      if(verbose){
+        if(i % print_every == 0){
+          printf("iteration %ld",i);
+          Rcout << "/"<<nburn + npost <<std::endl;
+        }
+      }
+      //draw bart
+      bm.draw(sigma,gen);
+      if(draw_sigma){
+        double restemp = 0, rss=0.0;
+        for(long k=0;k<n;k++) {restemp=(iy[k]-bm.f(k)); rss += restemp*restemp;}
+        sigma = sqrt((nu*lambda + rss)/gen.chi_square(n+nu));
+      }
+      
+      if(i>=nburn) {
+        for(long k=0;k<n;k++) trmean[k]+=bm.f(k);
+        keeptreedraw = npost && (((i-nburn+1) % skip) ==0);
+        if(keeptreedraw) {
+          if(draw_sigma)
+            tsigma.push_back(sigma);
+          for(long k=0;k<n;k++) trdraw[trcnt*n+k]=bm.f(k);
+          for(size_t j=0;j<(size_t)ntrees;j++)
+            ens.add(bm.gettree(j), bm.getxinfo());
+          std::vector<size_t>& ivarcnt=bm.getnv();
+          std::vector<double>& ivarprb=bm.getpv();
+          for(long j=0;j<p;j++){
+            varcnt[trcnt*p+j]=ivarcnt[j];
+            varprb[trcnt*p+j]=ivarprb[j];
+          }
+          trcnt+=1;
+        }
+      }
+    }
+    for(long k=0;k<n;k++) trmean[k]/=npost;
+  };
+  
   Environment G;
   Environment base;
   
@@ -467,6 +479,8 @@ private:
   double sigmaf;
   double tau;
   
+  std::vector<double> xv; //x as column stack, p x n
+  std::vector<double> yv; //centred y
   double *ix;
   double *iy;
   
@@ -479,7 +493,24 @@ private:
   
   List tree_object;
   
-  arn gen;
+  //output of the last mcmc()
+  bool draw_sigma;
+  size_t trcnt;
+  std::vector<double> trmean;
+  std::vector<double> trdraw;
+  std::vector<double> tsigma;
+  std::vector<int> varcnt;
+  std::vector<double> varprb;
+  ensemble ens; //kept trees, written out as text only by collect()
+  bool collected; //tree_object is up to date
+  
+  //prediction cache, see set_predict_cache()
+  size_t cn;
+  std::vector<unsigned short> cx; //binned, row major, cn x p
+  std::vector<double> cfit;
+  std::vector<std::vector<size_t> > vtrees;
+  
+  crn gen;
   bart bm;
 };
 
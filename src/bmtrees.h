@@ -53,18 +53,32 @@
 #include "cal_random_effects.h"
 #include "update_B.h"
 #include "update_Covariance.h"
+#include "lmm_init.h"
 #include <cmath>
 #endif
 
 using namespace Rcpp;
 
-class bmtrees{
+// The model variant: centralized DP mixture for the residuals and/or for the
+// random effects. It is a compile time choice, so the branches on it are
+// resolved when bmtrees is instantiated and not on every update.
+template<bool residual, bool random_effects> struct bmtrees_variant {
+  static constexpr bool CDP_residual = residual;
+  static constexpr bool CDP_re = random_effects;
+};
+typedef bmtrees_variant<true, true> BMTrees_variant;
+typedef bmtrees_variant<true, false> BMTrees_R_variant;
+typedef bmtrees_variant<false, true> BMTrees_RE_variant;
+typedef bmtrees_variant<false, false> mixedBART_variant;
+
+template<class variant> class bmtrees{
 public:
-  bmtrees(NumericVector Y, NumericMatrix X, Nullable<NumericMatrix> Z, CharacterVector subject_id, IntegerVector row_id, bool binary = false, bool CDP_residual = false, bool CDP_re = false, double tol=1e-40, int ntrees = 200, int resample = 0, double pi_CDP = 0.99, bool train = true) {     // Constructor
+  static constexpr bool CDP_residual = variant::CDP_residual;
+  static constexpr bool CDP_re = variant::CDP_re;
+  
+  bmtrees(NumericVector Y, NumericMatrix X, Nullable<NumericMatrix> Z, CharacterVector subject_id, IntegerVector row_id, bool binary = false, double tol=1e-40, int ntrees = 200, int resample = 0, double pi_CDP = 0.99, bool train = true) {     // Constructor
     if(train){
       this->tol = tol;
-      this->CDP_residual = CDP_residual;
-      this->CDP_re = CDP_re;
       this->resample = resample;
       
       if(Z.isNull()){
@@ -87,6 +101,7 @@ public:
       n_subject = unique(subject_id).length();
       alpha = 1 + NumericVector(n_subject);
       subject_to_B = create_subject_to_B(subject_id);
+      groups = create_subject_groups(subject_id, subject_to_B);
       n_obs_per_subject = max(table(subject_id));
       
       
@@ -132,32 +147,30 @@ public:
       
       tau_samples = NumericVector(N);
       B_tau_samples = NumericMatrix(n_subject, d);
-      Environment pkg_env = Environment::namespace_env("SBMTrees");
-      Function get_inverse_wishart_matrix2 = pkg_env["get_inverse_wishart_matrix2"];
-      List lmm = get_inverse_wishart_matrix2(this->X, this->Y, z, subject_id, subject_to_B);
-      NumericMatrix coe = as<NumericMatrix>(lmm["coe"]);
-      inverse_wishart_matrix = as<NumericMatrix>(lmm["covariance"]);
+      ztz = subject_crossprod(z, groups);
+      lmm_fit lmm = lmm_initialize(this->X, this->Y, z, groups.code, n_subject);
+      inverse_wishart_matrix = wrap(lmm.covariance);
       if(CDP_re){
         M_re = pow(n_subject, (double)(runif(1, 0, 0.5)[0]));
-        B_tau = DP(List::create(Named("p") = d, Named("cov") = as<NumericMatrix>(inverse_wishart_matrix)), M_re, sqrt(n_subject), n_subject, true);
-        B_tau_samples = as<NumericMatrix>(B_tau["samples"]);
-        Covariance = as<NumericMatrix>(B_tau["Sigma"]);
+        B_tau = dp_init(List::create(Named("p") = d, Named("cov") = as<NumericMatrix>(inverse_wishart_matrix)), M_re, sqrt(n_subject), n_subject, true);
+        B_tau_samples = wrap(B_tau.samples);
+        Covariance = wrap(B_tau.Sigma);
       }
       if(CDP_residual){
         M = pow(N, (double)(runif(1, 0, 0.5)[0]));
         if(binary){
           if(CDP_re)
-            tau = DP(List::create(Named("p") = 1, Named("sd") = 1, Named("pi") = pi_CDP), M, sqrt(N), N, true);
+            tau = dp_init(List::create(Named("p") = 1, Named("sd") = 1, Named("pi") = pi_CDP), M, sqrt(N), N, true);
           else
-            tau = DP(List::create(Named("p") = 1, Named("sd") = 1, Named("pi") = pi_CDP), M, sqrt(N), N, true);
+            tau = dp_init(List::create(Named("p") = 1, Named("sd") = 1, Named("pi") = pi_CDP), M, sqrt(N), N, true);
         }else{
           if(CDP_re)
-            tau = DP(List::create(Named("p") = 1, Named("sd") = (double)lmm["sigma"], Named("pi") = pi_CDP), M, sqrt(N), N, true);
+            tau = dp_init(List::create(Named("p") = 1, Named("sd") = lmm.sigma, Named("pi") = pi_CDP), M, sqrt(N), N, true);
           else
-            tau = DP(List::create(Named("p") = 1, Named("sd") = (double)lmm["sigma"], Named("pi") = pi_CDP), M, sqrt(N), N, true);
+            tau = dp_init(List::create(Named("p") = 1, Named("sd") = lmm.sigma, Named("pi") = pi_CDP), M, sqrt(N), N, true);
         }
-        sigma = as<double>(tau["sigma"]);
-        tau_samples = NumericVector(as<NumericMatrix>(tau["samples"])(_,0));
+        sigma = tau.sigma;
+        tau_samples = NumericVector(tau.samples.begin(), tau.samples.end());
         //Rcout << "initialization" << std::endl;
         //Rcout << tau_samples << std::endl;
       }
@@ -167,7 +180,7 @@ public:
       B = NumericMatrix(n_subject, d);
       //B = coe;
       
-      re = cal_random_effects(z, subject_id, B, subject_to_B);
+      re = cal_random_effects(z, groups.code, B);
       tree = new bart_model(this->X, this->Y - re - tau_samples, 100L, false, false, false,  ntrees);
       if(CDP_residual){
         tree -> update(sigma, 50, 50, 1, false, 10L);
@@ -184,6 +197,32 @@ public:
   }
 
   
+  // threads used by the random-effects and DP updates
+  void set_threads(int nthreads){
+    this->nthreads = nthreads < 1 ? 1 : nthreads;
+  }
+  
+  // threads used inside one draw of the trees, over blocks of rows
+  void set_tree_threads(int nthreads){
+    tree->set_threads(nthreads);
+  }
+  
+  // the tree draws from stream `stream` of the user seed
+  void set_seed(uint64_t seed, uint64_t stream){
+    tree->set_seed(seed, stream);
+  }
+  
+  // slice sampling (Walker) instead of the full scan of the truncated DP
+  // atoms in the assignments of both DP mixtures
+  void set_dp_slice(bool dp_slice){
+    this->dp_slice = dp_slice;
+  }
+  
+  // residuals and per-tree fits of the tree draws stored in float
+  void set_single_precision(bool single_precision){
+    tree->set_single(single_precision);
+  }
+  
   NumericVector get_Y(){
     return this->Y;
   }
@@ -229,7 +268,7 @@ public:
       if(!CDP_residual)
         sigma = tree -> get_invchi(N, rss);
       else
-        sigma = tau["sigma"];
+        sigma = tau.sigma;
         //sigma = 1;
         //sigma = 0.5;
       
@@ -244,22 +283,30 @@ public:
   
   void update_tree(){
     //Function update_tree = G["update_tree"];
+    prepare_tree();
+    draw_tree();
+    collect_tree();
+  }
+  
+  // the tree update is split in three steps so that the draws of several
+  // models can run at the same time: prepare_tree() and collect_tree() use R
+  // and must stay on the main thread, draw_tree() is plain C++
+  void prepare_tree(){
     NumericVector Y_ = Y - re - tau_samples;
-    
     tree->set_data(X, Y_);
-    List tree_obj = tree -> update(sigma, 1, 1, 1, false, 1L);
-    //Rcout << "123" << std::endl;
-    tree_pre = tree_obj["yhat.train.mean"];
+  }
+  
+  void draw_tree(){
+    tree -> draw(sigma, 1, 1, 1);
+  }
+  
+  void collect_tree(){
+    tree_pre = tree -> fitted();
     if(CDP_re || CDP_residual)
       tree_pre_mean = mean(tree_pre);
     else
       tree_pre_mean = 0;
     tree_pre = tree_pre - tree_pre_mean;
-    //Rcout << mean(tree_pre) << std::endl;
-    //Rcout << "456" << std::endl;
-    //sigma =  as<NumericVector>(tree_obj["sigma"])[0];
-    //Rcout << "789" << std::endl;
-    //Rcout << "sigma:" << sigma << std::endl;
   }
   
   List get_tree_training_data(){
@@ -288,8 +335,8 @@ public:
       NumericMatrix residual(N, 1, residual_tem.begin());
       if(verbose)
         Rcout << "update nDP residual" << std::endl;
-      tau["sigma"] = sigma;
-      return(List::create(Named("residual") = residual, Named("tau") = tau));
+      tau.sigma = sigma;
+      return(List::create(Named("residual") = residual, Named("tau") = dp_to_list(tau)));
     }else{
       return(List::create());
     }
@@ -299,20 +346,17 @@ public:
     if(CDP_re){
       if(verbose)
         Rcout << "update DP" << std::endl;
-      B_tau["Sigma"] = Covariance;
-      if(d == 1){
-        B_tau["sigma"] = Covariance;
-      }
-      return(List::create(Named("B") = B, Named("B_tau") = B_tau));
+      B_tau.Sigma = as<arma::mat>(Covariance);
+      return(List::create(Named("B") = B, Named("B_tau") = dp_to_list(B_tau)));
     }else{
       return(List::create());
     }
   }
   
   void set_CDP_re_data(List B_tau){
-    this->B_tau = B_tau;
-    B_tau_samples = as<NumericMatrix>(B_tau["samples"]);
-    M_re = B_tau["M"];
+    this->B_tau = dp_from_list(B_tau);
+    B_tau_samples = wrap(this->B_tau.samples);
+    M_re = this->B_tau.M;
   }
   
   void update_all(bool verbose = false){
@@ -320,6 +364,11 @@ public:
       Rcout << "update BART" << std::endl;
     
     update_tree();
+    update_effects(verbose);
+  }
+  
+  // everything in update_all() after the tree update
+  void update_effects(bool verbose = false){
     if(verbose)
       Rcout << "update residual" << std::endl;
     NumericVector residual_tem = Y - re - tree_pre;
@@ -329,13 +378,13 @@ public:
       //Rcout << "residual" << residual << std::endl;
       if(verbose)
         Rcout << "update DP residual" << std::endl;
-      tau["sigma"] = sigma;
+      tau.sigma = sigma;
       //Rcout<< sigma << std::endl;
       //Rcout << residual;
-      tau =  update_DP_normal(residual, tau, 0, 0.5);
-      tau_samples = tau["samples"];
-      M = tau["M"];
-      sigma = tau["sigma"];
+      dp_update_normal(residual, tau, 0, 0.5, dp_slice, nthreads);
+      tau_samples = NumericVector(tau.samples.begin(), tau.samples.end());
+      M = tau.M;
+      sigma = tau.sigma;
     }else{
       if(verbose)
         Rcout << "update sigma" << std::endl;
@@ -348,18 +397,15 @@ public:
     if(CDP_re){
       if(verbose)
         Rcout << "update DP random effects" << std::endl;
-      B_tau["Sigma"] = Covariance;
-      if(d == 1){
-        B_tau["sigma"] = Covariance;
-      }
+      B_tau.Sigma = as<arma::mat>(Covariance);
       //return List::create(Named("B") = B, Named("B_tau") = B_tau);
-      B_tau = update_DP_normal(B, B_tau, 0, 0.5);
-      B_tau_samples = as<NumericMatrix>(B_tau["samples"]);
-      M_re = B_tau["M"];
-      Covariance = as<NumericMatrix>(B_tau["Sigma"]);
+      dp_update_normal(B, B_tau, 0, 0.5, dp_slice, nthreads);
+      B_tau_samples = wrap(B_tau.samples);
+      M_re = B_tau.M;
+      Covariance = wrap(B_tau.Sigma);
       //Rcout << max(abs(Covariance)) << " ";
     }else{
-      Covariance = update_Covariance(clone(B), clone(B_tau_samples), inverse_wishart_matrix, d + 2, n_subject);
+      Covariance = update_Covariance(B, B_tau_samples, inverse_wishart_matrix, d + 2, n_subject);
     }
 
     if(verbose)
@@ -372,11 +418,11 @@ public:
     //Rcout << z << std::endl;
     //Rcout << B_tau_samples << std::endl;
     //Rcout << Covariance << std::endl;
-    B = update_B(Y - tau_samples - tree_pre, z, subject_id, B_tau_samples, subject_to_B, Covariance, sigma);
+    B = update_B(Y - tau_samples - tree_pre, z, groups, ztz, B_tau_samples, Covariance, sigma, nthreads);
 
     if(verbose)
       Rcout << "update random effects" << std::endl;
-    re = cal_random_effects(z, subject_id, B, subject_to_B);
+    re = cal_random_effects(z, groups.code, B);
     //re_arma = cal_random_effects_arma(Z_arma, subject_id, B_arma, subject_to_B);
 
     if(binary){
@@ -397,9 +443,10 @@ public:
   }
   
   
-  List posterior_sampling(){
+  // keep_tree = false leaves the trees out, they are written to text otherwise
+  List posterior_sampling(bool keep_tree = true){
     return List::create(
-      Named("tree") = tree->get_tree_object(),
+      Named("tree") = keep_tree ? tree->get_tree_object() : R_NilValue,
       Named("M") = M,
       Named("M_re") = M_re,
       Named("sigma") = sigma,// * Y_sd,
@@ -411,8 +458,8 @@ public:
       Named("re") = re,
       Named("tree_pre") = tree_pre + Y_mean,
       Named("y_predict") = tree_pre + re + tau_samples + Y_mean,//(tree_pre + re + tau_samples) * Y_sd + Y_mean,
-      Named("tau") = tau,
-      Named("B_tau") = B_tau,
+      Named("tau") = dp_to_list(tau),
+      Named("B_tau") = dp_to_list(B_tau),
       Named("tree_pre_mean") = tree_pre_mean
     );
   }
@@ -422,11 +469,11 @@ public:
   }
   
   NumericVector get_tau_mu(){
-    return tau["y"];
+    return NumericVector(tau.y.begin(), tau.y.end());
   }
   
   NumericVector get_tau_pi(){
-    return tau["pi"];
+    return NumericVector(tau.pi.begin(), tau.pi.end());
   }
   
   NumericVector get_B_tau_samples(){
@@ -434,15 +481,15 @@ public:
   }
   
   NumericVector get_B_tau_mu(){
-    return B_tau["y"];
+    return NumericVector(B_tau.y.begin(), B_tau.y.end());
   }
   
   NumericVector get_B_tau_pi(){
-    return B_tau["pi"];
+    return NumericVector(B_tau.pi.begin(), B_tau.pi.end());
   }
   
   NumericVector get_B_tau_lambda(){
-    return B_tau["lambda"];
+    return NumericVector::create(B_tau.lambda);
   }
   
   // NumericVector predict(NumericMatrix X_test, Nullable<NumericMatrix> Z_test, CharacterVector subject_id_test, IntegerVector row_id_test, bool keep_re = true){
@@ -478,7 +525,26 @@ public:
   //   return Y_mean + X_hat_test + random_test;
   // } 
   // 
-  NumericVector predict_expectation(NumericMatrix X_test, Nullable<NumericMatrix> Z_test, CharacterVector subject_id_test, IntegerVector row_id_test, bool keep_re = true){
+  void set_predict_cache(NumericMatrix X_test){
+    tree -> set_predict_cache(X_test);
+  }
+  
+  // predict_expectation() on the cached data with column col set to x_col on
+  // the given rows (0-based); only the trees splitting on col are revisited.
+  // The random part is the one kept by the last predict_expectation()
+  NumericVector predict_expectation_update(int col, NumericVector x_col, IntegerVector rows){
+    NumericVector X_hat_test = tree -> predict_cached(col, x_col, rows);
+    X_hat_test = X_hat_test - tree_pre_mean;
+    return Y_mean + X_hat_test + random_test;
+  }
+  
+  void update_predict_cache(int col, NumericVector x_col, IntegerVector rows){
+    tree -> update_predict_cache(col, x_col, rows);
+  }
+  
+  // with cached = true the tree part comes from the prediction cache, which
+  // has to be set on X_test by set_predict_cache() beforehand
+  NumericVector predict_expectation(NumericMatrix X_test, Nullable<NumericMatrix> Z_test, CharacterVector subject_id_test, IntegerVector row_id_test, bool keep_re = true, bool cached = false){
     //Rcout << "predict into" <<std::endl;
     int n = X_test.nrow();
     NumericMatrix z_test = NumericMatrix(n, d);
@@ -490,16 +556,16 @@ public:
         z_test(_, i) = (z0(_, i) - Z_mean[i]) / Z_sd[i];
       }
     }
-    NumericVector X_hat_test = colMeans(tree -> predict(X_test, false));
+    NumericVector X_hat_test = cached ? tree -> predict_cached() : colMeans(tree -> predict(X_test, false));
     X_hat_test = X_hat_test - tree_pre_mean;
     if(keep_re && random_test.length() > 0){
       ;
     }else{
-      re_test = cal_random_effects(z_test, subject_id_test, B, subject_to_B);
+      re_test = cal_random_effects(z_test, test_codes(subject_id_test), B);
       
       if(CDP_residual){
-        NumericVector values = tau["y"];
-        NumericVector pi = tau["pi"];
+        NumericVector values(tau.y.begin(), tau.y.end());
+        NumericVector pi(tau.pi.begin(), tau.pi.end());
         for(int i = 0 ; i < n ; ++i){
           double e = 0;
           if(resample > 0){
@@ -517,7 +583,7 @@ public:
     return Y_mean + X_hat_test + random_test;
   } 
   
-  NumericVector predict_sample(NumericMatrix X_test, Nullable<NumericMatrix> Z_test, CharacterVector subject_id_test, IntegerVector row_id_test, bool keep_re = true){
+  NumericVector predict_sample(NumericMatrix X_test, Nullable<NumericMatrix> Z_test, CharacterVector subject_id_test, IntegerVector row_id_test, bool keep_re = true, bool cached = false){
     int n = X_test.nrow();
     NumericMatrix z_test = NumericMatrix(n, d);
     if(!Z_test.isNull()){
@@ -527,12 +593,12 @@ public:
       }
     }
     
-    NumericVector X_hat = colMeans(tree -> predict(X_test, false));
+    NumericVector X_hat = cached ? tree -> predict_cached() : colMeans(tree -> predict(X_test, false));
     X_hat = X_hat - tree_pre_mean;
     if(keep_re && re_test.length() > 0){
       ;
     }else{
-      re_test = cal_random_effects(z_test, subject_id_test, B, subject_to_B);
+      re_test = cal_random_effects(z_test, test_codes(subject_id_test), B);
     }
     NumericVector e(n);
     if(resample == 0){
@@ -558,8 +624,8 @@ public:
       // }
     }else{
       if(CDP_residual){
-        NumericVector values = tau["y"];
-        NumericVector pi = tau["pi"];
+        NumericVector values(tau.y.begin(), tau.y.end());
+        NumericVector pi(tau.pi.begin(), tau.pi.end());
         for(int i = 0 ; i < n ; ++i){
           NumericVector loc = sample(values, resample, true, pi);
           e[i] = 0;
@@ -613,47 +679,9 @@ public:
   // } 
   // 
   double predict_probability_log(double Y_test, double Mu_test, int row_id_test){
-    double prob = 0; 
-    if(binary == false){
-      //if(CDP_residual){
-      if(false){
-        NumericVector values = tau["y"];
-        NumericVector pi = tau["pi"];
-        for(int j = 0 ; j < pi.length(); ++j){
-          auto it = row_id_to_id.find(std::to_string(row_id_test));
-          if (it != row_id_to_id.end()) {
-          //if (false) {
-            int pos = (int)(it->second);
-            prob = R::dnorm(Y_test, Mu_test + tau_samples[pos], sigma, true);
-          }else{ 
-            prob += pi[j] * R::dnorm(Y_test, Mu_test + values[j], sigma, true);
-          }
-          //prob += pi[j] * R::dnorm(Y_test, Mu_test + values[j], sigma, true);
-        }
-      }else{
-        prob = R::dnorm(Y_test, Mu_test, sigma, true);
-      }
-    }else{
-       //if(CDP_residual){
-        if(false){
-        NumericVector values = tau["y"];
-        NumericVector pi = tau["pi"];
-        for(int j = 0 ; j < pi.length(); ++j){
-          auto it = row_id_to_id.find(std::to_string(row_id_test));
-          if (it != row_id_to_id.end()) {
-          //if (false) {
-            prob = R::dbinom(Y_test, 1, R::pnorm(Mu_test, 0.0, 1.0, true, false), true);
-          }else{
-            prob += pi[j] * R::dbinom(Y_test, 1, R::pnorm(Mu_test + values[j], 0.0, 1.0, true, false), true);
-          }
-         // prob += pi[j] * R::dbinom(Y_test, 1, R::pnorm(Mu_test + values[j], 0.0, 1.0, true, false), true);
-        }
-      }else{
-        prob = R::dbinom(Y_test, 1, R::pnorm(Mu_test, 0.0, 1.0, true, false), true);
-        //prob = R::dnorm(Y_test, Mu_test, sigma, true);
-      }
-    }
-    return prob;
+    if(binary)
+      return R::dbinom(Y_test, 1, R::pnorm(Mu_test, 0.0, 1.0, true, false), true);
+    return R::dnorm(Y_test, Mu_test, sigma, true);
   } 
   
   double predict_probability_log_expectation(double Y_test, double Mu_test){
@@ -667,6 +695,19 @@ public:
   }
   
 private:
+  // subject codes of subject_id_test, reused while the same ids are passed
+  // (R strings are cached, so equal ids share their CHARSXP)
+  const std::vector<int>& test_codes(CharacterVector subject_id_test){
+    bool same = subject_id_test.length() == test_subject_id.length();
+    for(int i = 0; same && i < subject_id_test.length(); ++i)
+      same = STRING_ELT(subject_id_test, i) == STRING_ELT(test_subject_id, i);
+    if(!same){
+      test_subject_id = subject_id_test;
+      test_code = encode_subjects(subject_id_test, subject_to_B);
+    }
+    return test_code;
+  }
+  
   double tol;
   
   Environment G;
@@ -693,6 +734,12 @@ private:
   int resample;
   
   std::unordered_map<std::string, int> subject_to_B;
+  subject_groups groups;
+  std::vector<double> ztz;
+  int nthreads = 1;
+  bool dp_slice = false;
+  CharacterVector test_subject_id;
+  std::vector<int> test_code;
   std::unordered_map<std::string, int> row_id_to_id;
   NumericMatrix inverse_wishart_matrix;
   NumericMatrix Covariance;
@@ -702,18 +749,16 @@ private:
   double M_re = 0;
   double M = 0;
   double sigma = 1;
-  List tau;
-  List B_tau; 
+  dp_state tau;
+  dp_state B_tau;
   NumericVector tau_samples; 
   NumericMatrix B_tau_samples;
   
-  bool CDP_residual;
-  bool CDP_re;
   NumericVector re;
   arma::vec re_arma;
   
   //List tree;
-  bart_model * tree;
+  bart_model * tree = nullptr;
   
   NumericVector tree_pre;
   NumericVector random_test;
@@ -28,6 +28,16 @@
 #include "utils.h"
 #endif
 
+#ifndef SUBJECT_GROUPS_H_
+#define SUBJECT_GROUPS_H_
+#include "subject_groups.h"
+#endif
+
+#ifndef RE_KERNELS_H_
+#define RE_KERNELS_H_
+#include "re_kernels.h"
+#endif
+
 
 
 #include <Rcpp.h>
@@ -36,26 +46,31 @@
 using namespace Rcpp;
 using namespace arma;
 
-NumericVector cal_random_effects(NumericMatrix Z, CharacterVector subject_id, NumericMatrix B, std::unordered_map<std::string, int> subject_to_B){
-  
-  long N = subject_id.length();
-  NumericVector re(N);
-  //Rcout << 123 << std::endl;
-  for(int i = 0; i < N; ++i){
-    String subject = subject_id[i];
-    auto it = subject_to_B.find(std::string(subject_id[i]));
-    if (it != subject_to_B.end()) {
-    
-    //Rcout << 456 << std::endl;
-    
-    int b_pos = (int)(it->second);
-    NumericVector zi = Z(i,_);
-    NumericVector Bi = B(b_pos,_);
-    double zi_Bi = innerProduct(zi, Bi);
-    re[i] = zi_Bi;
+template<int D> void cal_random_effects_rows(const double* z, long N, const std::vector<int>& code, const double* b, long n_subject, int d, double* re){
+  const int n = D > 0 ? D : d;
+  for(long i = 0; i < N; ++i){
+    int b_pos = code[i];
+    if(b_pos >= 0){
+      double zi_Bi = 0;
+      for(int k = 0; k < n; ++k)
+        zi_Bi += z[i + k * N] * b[b_pos + k * n_subject];
+      re[i] = zi_Bi;
     }
-  } 
-  //Rcout << 1213 << std::endl;
+  }
+}
+
+// random effect Z[i, ] B[code[i], ] of each row, 0 for rows with code -1
+NumericVector cal_random_effects(const NumericMatrix& Z, const std::vector<int>& code, const NumericMatrix& B){
+  long N = code.size();
+  int d = Z.ncol();
+  NumericVector re(N);
+  switch(d){
+  case 1: cal_random_effects_rows<1>(Z.begin(), N, code, B.begin(), B.nrow(), d, re.begin()); break;
+  case 2: cal_random_effects_rows<2>(Z.begin(), N, code, B.begin(), B.nrow(), d, re.begin()); break;
+  case 3: cal_random_effects_rows<3>(Z.begin(), N, code, B.begin(), B.nrow(), d, re.begin()); break;
+  case 4: cal_random_effects_rows<4>(Z.begin(), N, code, B.begin(), B.nrow(), d, re.begin()); break;
+  default: cal_random_effects_rows<0>(Z.begin(), N, code, B.begin(), B.nrow(), d, re.begin()); break;
+  }
   return re;
 }
 
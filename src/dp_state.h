@@ -0,0 +1,132 @@
+/*
+ *  SBMTrees: Sequential imputation with Bayesian Trees Mixed-Effects models
+ *  Copyright (C) 2024 Jungang Zou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+#ifndef ARMADILLO_H_
+#define ARMADILLO_H_
+#include <RcppArmadillo.h>
+// [[Rcpp::depends(RcppArmadillo)]]
+#endif
+
+#include <Rcpp.h>
+#include <string>
+#include <vector>
+
+using namespace Rcpp;
+using namespace arma;
+
+// State of a truncated (centralized) DP mixture of normals, the C++ version
+// of the list built by DP() and updated by update_DP_normal(). With
+// univariate = true (the list has "sd") the kernel is N(y_h, sigma^2) in one
+// dimension, otherwise N(y_h, Sigma) in p dimensions. The atoms are
+// y_h ~ N(mu, lambda sigma^2) or N(mu, lambda Sigma).
+struct dp_state {
+  // prior
+  bool univariate = true;
+  bool CDP = true;
+  int p = 1;
+  double pi_prior = 0.99;  // parameters["pi"]
+  double a = 0, b = 0;     // lambda ~ IG(a, b)
+  double sd = 1;           // univariate: initial sd, sigma ~ scaled IG(v, k)
+  double v = 0, k = 0;
+  arma::vec mu;            // prior mean of the atoms
+  arma::mat cov, Psi;      // multivariate: Sigma ~ IW(d, Psi)
+  double d = 0;
+
+  // current values
+  double M = 0;
+  double lambda = 0;
+  double sigma = 1;
+  arma::mat Sigma;
+  arma::mat y;                 // K x p atoms
+  arma::vec pi;                // K weights
+  std::vector<int> cluster;    // atom of each of the N samples
+  std::vector<int> nk;         // number of samples on each atom
+  arma::mat samples;           // N x p, samples.row(i) = y.row(cluster[i])
+
+  bool empty() const {return y.n_rows == 0;}
+  long K() const {return y.n_rows;}
+};
+
+// the list layout of DP() / update_DP_normal()
+List dp_to_list(const dp_state& s){
+  if(s.empty())
+    return List::create();
+  long K = s.K();
+  CharacterVector names(K);
+  for(long h = 0; h < K; ++h)
+    names[h] = std::to_string(h);
+  IntegerVector cluster(s.cluster.begin(), s.cluster.end());
+  NumericVector pi(s.pi.begin(), s.pi.end());
+  pi.names() = names;
+  NumericMatrix y = wrap(s.y);
+  rownames(y) = names;
+  NumericMatrix samples = wrap(s.samples);
+  rownames(samples) = cluster;
+
+  List parameters = List::create(Named("distribution") = "normal", Named("p") = s.p, Named("pi") = s.pi_prior, Named("a") = s.a, Named("b") = s.b, Named("lambda") = s.lambda, Named("CDP") = s.CDP);
+  if(s.univariate){
+    parameters["sd"] = s.sd;
+    parameters["v"] = s.v;
+    parameters["k"] = s.k;
+    parameters["mu"] = s.mu[0];
+    parameters["sigma"] = s.sigma;
+    return List::create(Named("samples") = samples, Named("cluster") = cluster, Named("pi") = pi, Named("parameters") = parameters, Named("y") = y, Named("M") = s.M, Named("lambda") = s.lambda, Named("sigma") = s.sigma);
+  }
+  parameters["cov"] = wrap(s.cov);
+  parameters["mu"] = NumericVector(s.mu.begin(), s.mu.end());
+  parameters["d"] = s.d;
+  parameters["Psi"] = wrap(s.Psi);
+  parameters["Sigma"] = wrap(s.Sigma);
+  return List::create(Named("samples") = samples, Named("cluster") = cluster, Named("pi") = pi, Named("parameters") = parameters, Named("y") = y, Named("M") = s.M, Named("lambda") = s.lambda, Named("Sigma") = wrap(s.Sigma));
+}
+
+dp_state dp_from_list(List tau){
+  dp_state s;
+  if(tau.length() == 0)
+    return s;
+  List parameters = tau["parameters"];
+  s.univariate = parameters.containsElementNamed("sd");
+  s.CDP = parameters["CDP"];
+  s.p = as<int>(parameters["p"]);
+  s.pi_prior = parameters["pi"];
+  s.a = parameters["a"];
+  s.b = parameters["b"];
+  s.mu = as<arma::vec>(parameters["mu"]);
+  if(s.univariate){
+    s.sd = parameters["sd"];
+    s.v = parameters["v"];
+    s.k = parameters["k"];
+    s.sigma = tau["sigma"];
+  }else{
+    s.cov = as<arma::mat>(parameters["cov"]);
+    s.d = parameters["d"];
+    s.Psi = as<arma::mat>(parameters["Psi"]);
+    s.Sigma = as<arma::mat>(tau["Sigma"]);
+  }
+  s.M = tau["M"];
+  s.lambda = tau["lambda"];
+  s.y = as<arma::mat>(tau["y"]);
+  s.pi = as<arma::vec>(tau["pi"]);
+  s.cluster = as<std::vector<int>>(tau["cluster"]);
+  s.samples = as<arma::mat>(tau["samples"]);
+  s.nk.assign(s.K(), 0);
+  for(int c : s.cluster)
+    s.nk[c]++;
+  return s;
+}
@@ -0,0 +1,162 @@
+/*
+ *  SBMTrees: Sequential imputation with Bayesian Trees Mixed-Effects models
+ *  Copyright (C) 2024 Jungang Zou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+#ifndef ARMADILLO_H_
+#define ARMADILLO_H_
+#include <RcppArmadillo.h>
+// [[Rcpp::depends(RcppArmadillo)]]
+#endif
+
+#include <Rcpp.h>
+#include <cmath>
+#include <vector>
+
+using namespace Rcpp;
+using namespace arma;
+
+// starting values of the mixed model Y ~ 0 + X + (0 + Z | subject)
+struct lmm_fit {
+  mat coe;         // predicted random effects, one row per subject
+  double sigma;    // residual sd
+  mat covariance;  // covariance of the random effects
+};
+
+// Replacement of the R function get_inverse_wishart_matrix2 (lme4::lmer):
+// the columns of X are standardized (constant columns dropped), the model is
+// fitted by EM and the covariance is then repaired until it is positive
+// definite with condition number at most 500. The residual variance uses the
+// N - rank(X) denominator as an approximation of REML. Only reads its
+// arguments, so it is safe to call off the R thread.
+lmm_fit lmm_initialize(const NumericMatrix& X, const NumericVector& Y, const NumericMatrix& Z, const std::vector<int>& subject, int n_subject, int max_iter = 200, double tol = 1e-6){
+  const int N = Y.length();
+  const int d = Z.ncol();
+
+  // standardized non-constant columns of X
+  std::vector<int> keep;
+  for(int j = 0; j < X.ncol(); ++j){
+    const double* xj = X.begin() + (size_t)j * N;
+    for(int i = 1; i < N; ++i){
+      if(xj[i] != xj[0]){
+        keep.push_back(j);
+        break;
+      }
+    }
+  }
+  mat x(N, keep.size());
+  for(size_t k = 0; k < keep.size(); ++k){
+    vec xj(X.begin() + (size_t)keep[k] * N, N);
+    x.col(k) = (xj - mean(xj)) / stddev(xj);
+  }
+  const vec y(Y.begin(), N);
+  const mat z(Z.begin(), N, d);
+
+  // rows of each subject
+  std::vector<std::vector<int>> rows(n_subject);
+  for(int i = 0; i < N; ++i)
+    rows[subject[i]].push_back(i);
+  std::vector<mat> ztz(n_subject);
+  for(int s = 0; s < n_subject; ++s){
+    ztz[s] = zeros<mat>(d, d);
+    for(int i : rows[s])
+      ztz[s] += z.row(i).t() * z.row(i);
+  }
+
+  // start from least squares with the residual variance split evenly
+  mat xtx_inv;
+  vec beta;
+  if(x.n_cols > 0){
+    xtx_inv = pinv(x.t() * x);
+    beta = xtx_inv * (x.t() * y);
+  }
+  vec r = x.n_cols > 0 ? vec(y - x * beta) : y;
+  double sigma2 = std::max(dot(r, r) / std::max(N - (int)x.n_cols, 1), 1e-8);
+  mat D = eye<mat>(d, d) * sigma2;
+
+  mat coe(n_subject, d, fill::zeros);
+  std::vector<mat> Vb(n_subject);
+  vec zb(N);
+  for(int iter = 0; iter < max_iter; ++iter){
+    // E step: conditional mean and covariance of each b_s
+    mat D_inv = inv_sympd(D);
+    mat D_new(d, d, fill::zeros);
+    double rss = 0;
+    for(int s = 0; s < n_subject; ++s){
+      vec zr(d, fill::zeros);
+      for(int i : rows[s])
+        zr += z.row(i).t() * r[i];
+      Vb[s] = inv_sympd(symmatu(ztz[s] / sigma2 + D_inv));
+      vec b = Vb[s] * zr / sigma2;
+      coe.row(s) = b.t();
+      D_new += b * b.t() + Vb[s];
+      for(int i : rows[s]){
+        zb[i] = dot(z.row(i), b);
+        double e = r[i] - zb[i];
+        rss += e * e;
+      }
+      rss += accu(ztz[s] % Vb[s]);
+    }
+    // M step
+    if(x.n_cols > 0){
+      beta = xtx_inv * (x.t() * (y - zb));
+      r = y - x * beta;
+    }
+    D_new = symmatu(D_new / n_subject);
+    double sigma2_new = std::max(rss / std::max(N - (int)x.n_cols, 1), 1e-8);
+    bool converged = std::abs(sigma2_new - sigma2) <= tol * sigma2 && norm(D_new - D, "fro") <= tol * norm(D, "fro");
+    sigma2 = sigma2_new;
+    D = D_new;
+    if(converged)
+      break;
+  }
+
+  // same repair as get_inverse_wishart_matrix2
+  mat co = D;
+  if(d > 1){
+    mat U, V;
+    vec sv;
+    svd(U, sv, V, co);
+    double tolerance = 1e-10 * sv.max();
+    mat R;
+    while(sv.max() / sv.min() > 500 || !chol(R, co)){
+      if(tolerance > sv.max()){
+        if(chol(R, co))
+          break;
+        vec ev = eig_sym(co);
+        if(ev.min() >= 0)
+          break;
+        co.diag() += -ev.min() + 1e-10;
+        svd(U, sv, V, co);
+        tolerance = 1e-10 * sv.max();
+        continue;
+      }
+      tolerance *= 2;
+      svd(U, sv, V, co);
+      co = U * diagmat(clamp(sv, tolerance, sv.max())) * V.t();
+      co.diag() += 1e-8;
+      co = (co + co.t()) / 2;
+      svd(U, sv, V, co);
+    }
+  }
+
+  lmm_fit fit;
+  fit.coe = coe;
+  fit.sigma = std::sqrt(sigma2);
+  fit.covariance = co;
+  return fit;
+}
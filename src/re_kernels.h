@@ -0,0 +1,145 @@
+/*
+ *  SBMTrees: Sequential imputation with Bayesian Trees Mixed-Effects models
+ *  Copyright (C) 2024 Jungang Zou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+#include <cmath>
+#include <vector>
+
+// Small dense kernels in the random-effect dimension d. The template
+// argument D is d known at compile time (1 to 4, the usual random intercept
+// and slopes), so the loops have fixed bounds and the work arrays live on the
+// stack; D = 0 is the fallback that takes d at run time and allocates.
+// Callers switch on d once and run the whole loop with the matching D.
+// Matrices are column major.
+
+// n doubles, on the stack for N > 0
+template<int N> struct re_buffer {
+  double v[N];
+  explicit re_buffer(int){}
+  double* data(){return v;}
+};
+template<> struct re_buffer<0> {
+  std::vector<double> v;
+  explicit re_buffer(int n):v(n){}
+  double* data(){return v.data();}
+};
+
+// lower Cholesky factor of the d x d P in place, false if P is not positive
+// definite
+template<int D> bool re_chol(double* P, int d){
+  const int n = D > 0 ? D : d;
+  for(int j = 0; j < n; ++j){
+    double s = P[j + j * n];
+    for(int k = 0; k < j; ++k)
+      s -= P[j + k * n] * P[j + k * n];
+    if(!(s > 0))
+      return false;
+    double l = std::sqrt(s);
+    P[j + j * n] = l;
+    for(int i = j + 1; i < n; ++i){
+      double t = P[i + j * n];
+      for(int k = 0; k < j; ++k)
+        t -= P[i + k * n] * P[j + k * n];
+      P[i + j * n] = t / l;
+    }
+  }
+  return true;
+}
+
+// x = L^-1 x
+template<int D> void re_solve_lower(const double* L, double* x, int d){
+  const int n = D > 0 ? D : d;
+  for(int a = 0; a < n; ++a){
+    double t = x[a];
+    for(int c = 0; c < a; ++c)
+      t -= L[a + c * n] * x[c];
+    x[a] = t / L[a + a * n];
+  }
+}
+
+// x = L'^-1 x
+template<int D> void re_solve_upper(const double* L, double* x, int d){
+  const int n = D > 0 ? D : d;
+  for(int a = n - 1; a >= 0; --a){
+    double t = x[a];
+    for(int c = a + 1; c < n; ++c)
+      t -= L[c + a * n] * x[c];
+    x[a] = t / L[a + a * n];
+  }
+}
+
+// sum_k (x_k - mu_k)' Sigma^-1 (x_k - mu_k) / 2 for one x against the K
+// rows of mu (K x d), L being the Cholesky factor of Sigma; the k-th result
+// goes to out[k]
+template<int D> void re_half_quadratic(const double* x, const double* mu, long K, const double* L, int d, double* out){
+  const int n = D > 0 ? D : d;
+  re_buffer<D> u(n);
+  for(long k = 0; k < K; ++k){
+    for(int a = 0; a < n; ++a)
+      u.data()[a] = x[a] - mu[k + a * K];
+    re_solve_lower<D>(L, u.data(), d);
+    double q = 0;
+    for(int a = 0; a < n; ++a)
+      q += u.data()[a] * u.data()[a];
+    out[k] = q / 2;
+  }
+}
+
+// out += (A - C)' (A - C) for the n x d A and C
+template<int D> void re_add_crossprod_diff(const double* A, const double* C, long n, int d, double* out){
+  const int m = D > 0 ? D : d;
+  re_buffer<D> r(m);
+  for(long i = 0; i < n; ++i){
+    for(int a = 0; a < m; ++a)
+      r.data()[a] = A[i + a * n] - C[i + a * n];
+    for(int b = 0; b < m; ++b)
+      for(int a = 0; a < m; ++a)
+        out[a + b * m] += r.data()[a] * r.data()[b];
+  }
+}
+
+// re_chol, re_half_quadratic and re_solve_lower for a d known only at run time
+bool re_chol(double* P, int d){
+  switch(d){
+  case 1: return re_chol<1>(P, d);
+  case 2: return re_chol<2>(P, d);
+  case 3: return re_chol<3>(P, d);
+  case 4: return re_chol<4>(P, d);
+  default: return re_chol<0>(P, d);
+  }
+}
+
+void re_half_quadratic(const double* x, const double* mu, long K, const double* L, int d, double* out){
+  switch(d){
+  case 1: re_half_quadratic<1>(x, mu, K, L, d, out); break;
+  case 2: re_half_quadratic<2>(x, mu, K, L, d, out); break;
+  case 3: re_half_quadratic<3>(x, mu, K, L, d, out); break;
+  case 4: re_half_quadratic<4>(x, mu, K, L, d, out); break;
+  default: re_half_quadratic<0>(x, mu, K, L, d, out); break;
+  }
+}
+
+void re_solve_lower(const double* L, double* x, int d){
+  switch(d){
+  case 1: re_solve_lower<1>(L, x, d); break;
+  case 2: re_solve_lower<2>(L, x, d); break;
+  case 3: re_solve_lower<3>(L, x, d); break;
+  case 4: re_solve_lower<4>(L, x, d); break;
+  default: re_solve_lower<0>(L, x, d); break;
+  }
+}
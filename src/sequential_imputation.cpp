@@ -36,9 +36,9 @@
 #include <vector>
 #include <ctime>
 
-// #ifdef _OPENMP
-// #include <omp.h>
-// #endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // [[Rcpp::depends(RcppProgress)]]
 #include <progress.hpp>
@@ -51,18 +51,194 @@ using namespace Rcpp;
 
 
 
-// [[Rcpp::export]]
-List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool binary_outcome = false, int nburn = 0, int npost = 3, int skip = 1, bool verbose = true, bool CDP_residual = false, bool CDP_re = false, Nullable<long> seed = R_NilValue, double tol = 1e-20, int ncores = 0, int ntrees = 200, bool fit_loss = false, int resample = 0, double pi_CDP = 0.99) {
+// state of one Markov chain of the sequential imputation
+template<class variant> struct imputation_chain{
+  std::vector<bmtrees<variant>> chain_collection;
+  NumericMatrix X;
+  NumericVector Y;
+  List imputation_X_DP;
+  List imputation_Y_DP;
+};
+
+
+// impute the missing covariates and outcome of one chain given its current models
+template<class variant> static void impute_chain(imputation_chain<variant>& chain, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool outcome_is_missing, CharacterVector X_names, bool verbose){
+  std::vector<bmtrees<variant>>& chain_collection = chain.chain_collection;
+  NumericMatrix X = chain.X;
+  NumericVector Y = chain.Y;
+  int n = X.nrow();
+  int p = X.cols();
+  NumericMatrix prob_collection_dom_log(n, p);
+  NumericMatrix prob_collection_num_log_expectation(n, p);
+  // the predictions of every model are cached here and kept in sync with X
+  // below, so a proposal for one column only revisits the trees using it
+  for(int i = 0 ; i < p ; ++i){
+    if(i == p - 1){
+      chain_collection[i].set_predict_cache(X);
+      NumericVector y_predict_mu = chain_collection[i].predict_expectation(clone(X), clone(Z), clone(subject_id), seqC(1, Y.length()), true, true);
+      for(int j = 0; j < n; ++j){
+        if(R(j, i + 1)){
+          prob_collection_dom_log(j, i) = chain_collection[i].predict_probability_log(Y[j], y_predict_mu[j], j);
+          prob_collection_num_log_expectation(j, i) = chain_collection[i].predict_probability_log_expectation(Y[j], y_predict_mu[j]);
+        }
+      }
+      break;
+    }
+    if(sum(R(_, i + 1)) == 0){
+      continue;
+    }
+    NumericMatrix X_train = X(_, Range(0,i));
+    NumericVector y_train = X(_, i + 1);
+    chain_collection[i].set_predict_cache(X_train);
+    NumericVector y_predict_mu = chain_collection[i].predict_expectation(clone(X_train), clone(Z), clone(subject_id), seqC(1, Y.length()), true, true);
+
+    for(int j = 0; j < n; ++j){
+      if(R(j, i + 1)){
+        prob_collection_dom_log(j, i) = chain_collection[i].predict_probability_log(y_train[j], y_predict_mu[j], j);
+        prob_collection_num_log_expectation(j, i) = chain_collection[i].predict_probability_log_expectation(y_train[j], y_predict_mu[j]);
+      }
+    }
+  }
+  // 
+  // 
+  // imputation propose
+  for (int i = 0; i < p - 1; ++i) {
+    if(verbose){
+      std::string blank(30 - as<std::string>(X_names[i+1]).length(), ' ');
+      Rcout << X_names[i+1] << blank;
+    }
+    if(sum(R(_, i + 1)) == 0){
+      if(verbose)
+        Rcout << "No missing data." << std::endl;
+      continue;
+    }
+
+    NumericMatrix prob_collection_num_log(n, p);
+    NumericMatrix prob_collection_dom_log_expectation(n, p);
+    NumericMatrix X_train = X(_, Range(0,i));
+    NumericVector y_train = X(_, i + 1);
+    // sample new value
+    NumericVector new_y_train(Y.length());
+    if(type[i + 1] == 0)
+      new_y_train = chain_collection[i].predict_sample(X_train, Z, subject_id, seqC(1, Y.length()), true, true);
+    else
+      new_y_train = new_y_train + 1;
+    NumericVector y_predict_mu = chain_collection[i].predict_expectation(X_train, Z, subject_id, seqC(1, Y.length()), true, true);
+    for(int j = 0; j < n; ++j){
+      prob_collection_num_log(j,i) = chain_collection[i].predict_probability_log(new_y_train[j], y_predict_mu[j], j);
+      prob_collection_dom_log_expectation(j,i) = chain_collection[i].predict_probability_log_expectation(new_y_train[j], y_predict_mu[j]);
+    }
+    // only the rows missing in column i + 1 can take the proposal, so the
+    // downstream models are re-predicted on those rows only; models of fully
+    // observed columns are never fitted and have no cache
+    LogicalVector miss_ind = R(_, i + 1);
+    IntegerVector miss_rows = seqC(0, n - 1)[miss_ind];
+    for(int j = i + 2; j < p; ++j){
+      if(sum(R(_, j)) == 0)
+        continue;
+      NumericVector y_predict_mu = chain_collection[j - 1].predict_expectation_update(i + 1, new_y_train, miss_rows);
+
+
+      for(int k = 0; k < n; ++k){
+        if(R(k, j)){
+          prob_collection_num_log(k, j - 1) = chain_collection[j - 1].predict_probability_log(X(k,j), y_predict_mu[k], k);
+        }
+      }
+    }
+    y_predict_mu = chain_collection[p - 1].predict_expectation_update(i + 1, new_y_train, miss_rows);
+    for(int k = 0; k < n; ++k){
+      if(R(k, p)){
+        prob_collection_num_log(k, p - 1) = chain_collection[p - 1].predict_probability_log(Y[k], y_predict_mu[k], k);
+      }
+    }
+    int missing = 0;
+    int replace = 0;
+    for(int k = 0 ; k < n; ++k){
+      if (R(k, i + 1) == 1){
+        if(type[i + 1] == 0){
+          missing++;
+          NumericVector num_log = prob_collection_num_log(k, _);// Rcpp::Range(i + 1, p - 1));
+          NumericVector dom_log = prob_collection_dom_log(k, _);// Rcpp::Range(i + 1, p - 1));
+          num_log = num_log[Range(i, p - 1)];
+          dom_log = dom_log[Range(i, p - 1)];
+          double log_accept = sum(num_log) - sum(dom_log) + prob_collection_num_log_expectation(k, i) - prob_collection_dom_log_expectation(k, i);// + prob_collection_num_log(k, i) - prob_collection_dom_log(k, i);
+          if(log(runif(1)[0]) < log_accept){
+            replace++;
+            X(k, i + 1) = new_y_train[k];
+          }
+        }else{
+          missing++;
+          NumericVector num_log = prob_collection_num_log(k, _);
+          num_log = exp(num_log[Range(i, p - 1)]);
+          NumericVector zero_num_log = 1 - num_log;
+          double accept_p = sum(num_log) / (sum(num_log) + sum(zero_num_log));
+          int previous = X(k, i + 1);
+          X(k, i + 1) = R::rbinom(1, accept_p);
+          if(previous != X(k, i + 1)){
+            replace++;
+          }
+        }
+      }
+    }
+    NumericVector x_new = X(_, i + 1);
+    for(int j = i + 1; j < p; ++j)
+      if(j == p - 1 || sum(R(_, j + 1)) != 0)
+        chain_collection[j].update_predict_cache(i + 1, x_new, miss_rows);
+    double ar = replace;
+    ar = ar / missing;
+    if(verbose)
+      Rcout << "Replace proportion:" << ar << std::endl;
+  }
+  if(outcome_is_missing){
+    NumericVector new_y_train = chain_collection[p - 1].predict_sample(X, Z, subject_id, seqC(1, Y.length()), true, true);  // this is conditional expectation E(Y|X, Z)
+    //NumericVector y_predict_mu = chain_collection[p - 1].predict_expectation(X, Z, subject_id, seqC(1, Y.length()));
+    //NumericVector prob_collection_dom_log_expectation_y(n);
+    //NumericVector prob_collection_num_log_y(n);
+    int missing = 0;
+    int replace = 0;
+    for(int k = 0 ; k < n; ++k){
+      if (R(k, p) == 1){
+        //prob_collection_num_log_y[k] = chain_collection[p - 1].predict_probability_log(new_y_train[k], y_predict_mu[k], k);
+        //prob_collection_dom_log_expectation_y[k] = chain_collection[p - 1].predict_probability_log_expectation(new_y_train[k], y_predict_mu[k]);
+        missing++;
+        //double num_log_y = prob_collection_num_log_y[k];
+        //double dom_log_y = prob_collection_dom_log(k, p - 1);
+        //double log_accept = 1*(num_log_y - dom_log_y) + prob_collection_num_log_expectation(k, p - 1) - prob_collection_dom_log_expectation_y[k];
+        //if(log(runif(1)[0]) < log_accept){
+        replace++;
+        Y[k] = new_y_train[k];
+        //}
+      }
+    }
+    double ar = replace;
+    ar = ar / missing;
+    if(verbose){
+      std::string blank(23, ' ');
+      Rcout << "OUTCOME" << blank;
+      Rcout << "Replace proportion:" << ar << std::endl;
+    }
+  }
+}
+
+
+
+// sequential_imputation_cpp() for one model variant
+template<class variant> static List sequential_imputation_run(NumericMatrix X, NumericVector Y, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool binary_outcome, int nburn, int npost, int skip, bool verbose, double tol, int ncores, int ntrees, bool fit_loss, int resample, double pi_CDP, int nchains, bool dp_slice, bool single_precision, Nullable<long> seed) {
   //Rcpp::Environment base("package:base");
   //Rcpp::Environment G = Rcpp::Environment::global_env();
   
-  int n = X.nrow();
   int p = X.cols();
   List imputation_X_DP = List::create();
   List imputation_Y_DP = List::create();
   int  skip_indicator = -1;
+  int nthreads = ncores < 1 ? 1 : ncores;
+  if(nchains < 1)
+    nchains = 1;
  
-  std::vector<bmtrees> chain_collection; 
+  // every chain starts from the same data and has its own models, the models
+  // are seeded one after the other from the R RNG (or from their own streams
+  // of seed) so the chains are independent
+  std::vector<imputation_chain<variant>> chains(nchains);
   bool outcome_is_missing = (sum(R(_, p)) != 0);
   
   if (outcome_is_missing){
@@ -94,37 +270,74 @@ List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector t
     Rcout << "Start initializing models" << std::endl;
     Rcout << std::endl;
   }
-  Progress progin(p, !verbose);
-  for(int i = 0; i < p; ++i){
-    if (Progress::check_abort() )
-      return -1.0;
-    progin.increment();
-    if(i == p - 1){
-      // fit outcome model
-      NumericVector Y_obs = Y[no_loss_ind];
+  Progress progin(p * nchains, !verbose);
+  for(int c = 0; c < nchains; ++c){
+    chains[c].X = clone(X);
+    chains[c].Y = clone(Y);
+    chains[c].imputation_X_DP = List::create();
+    chains[c].imputation_Y_DP = List::create();
+    std::vector<bmtrees<variant>>& chain_collection = chains[c].chain_collection;
+    for(int i = 0; i < p; ++i){
+      if (Progress::check_abort() )
+        return -1.0;
+      progin.increment();
+      if(i == p - 1){
+        // fit outcome model
+        NumericVector Y_obs = Y[no_loss_ind];
+        
+        NumericMatrix X_obs = row_matrix(X, no_loss_ind);
+        NumericMatrix Z_obs = row_matrix(Z, no_loss_ind);
+        CharacterVector subject_id_obs = subject_id[no_loss_ind];
+        IntegerVector row_id_obs = seqC(1, Y.length())[no_loss_ind];
+        chain_collection.push_back(bmtrees<variant>(clone(Y_obs), clone(X_obs), clone(Z_obs), clone(subject_id_obs), clone(row_id_obs), binary_outcome, tol, ntrees, resample, pi_CDP, true));
+        break;
+      }
       
-      NumericMatrix X_obs = row_matrix(X, no_loss_ind);
-      NumericMatrix Z_obs = row_matrix(Z, no_loss_ind);
-      CharacterVector subject_id_obs = subject_id[no_loss_ind];
-      IntegerVector row_id_obs = seqC(1, Y.length())[no_loss_ind];
-      chain_collection.push_back(bmtrees(clone(Y_obs), clone(X_obs), clone(Z_obs), clone(subject_id_obs), clone(row_id_obs), binary_outcome, CDP_residual, CDP_re, tol, ntrees, resample, pi_CDP, true));
-      break;
+      NumericMatrix X_t = X(_, Range(0,i));
+      NumericMatrix X_train = row_matrix(X_t, no_loss_ind);
+      NumericVector y_t = X(_, i + 1);
+      NumericVector y_train = y_t[no_loss_ind];
+      NumericMatrix Z_train = row_matrix(Z, no_loss_ind);
+      CharacterVector subject_id_train = subject_id[no_loss_ind];
+      IntegerVector row_id_obs = seqC(1, y_t.length())[no_loss_ind];
+      chain_collection.push_back(bmtrees<variant>(clone(y_train), clone(X_train), clone(Z_train), clone(subject_id_train), clone(row_id_obs), type[i+1], tol, ntrees, resample, pi_CDP, (sum(R(_, i + 1)) != 0)));
     }
-    
-    NumericMatrix X_t = X(_, Range(0,i));
-    NumericMatrix X_train = row_matrix(X_t, no_loss_ind);
-    NumericVector y_t = X(_, i + 1);
-    NumericVector y_train = y_t[no_loss_ind];
-    NumericMatrix Z_train = row_matrix(Z, no_loss_ind);
-    CharacterVector subject_id_train = subject_id[no_loss_ind];
-    IntegerVector row_id_obs = seqC(1, y_t.length())[no_loss_ind];
-    chain_collection.push_back(bmtrees(clone(y_train), clone(X_train), clone(Z_train), clone(subject_id_train), clone(row_id_obs), type[i+1], CDP_residual, CDP_re, tol, ntrees, resample, pi_CDP, (sum(R(_, i + 1)) != 0)));
   }
   if (true){
     Rcout << std::endl;
     Rcout << "Complete initialization" << std::endl;
     Rcout << std::endl;
   }
+  
+  // models to be updated in each iteration
+  std::vector<int> active;
+  for(int i = 0; i < p; ++i){
+    if(i == p - 1 || sum(R(_, i + 1)) != 0)
+      active.push_back(i);
+  }
+  int n_active = active.size();
+  // the outcome models are drawn one after the other with all threads on the
+  // rows of each draw; the covariate models are drawn in parallel, one thread
+  // each, unless there are fewer of them than threads
+  int n_cov = n_active - 1;
+  int n_draws = nchains * n_cov;
+  int cov_threads = n_draws < nthreads ? nthreads : 1;
+  for(int c = 0; c < nchains; ++c)
+    for(int j = 0; j < n_active; ++j){
+      chains[c].chain_collection[active[j]].set_threads(nthreads);
+      chains[c].chain_collection[active[j]].set_tree_threads(active[j] == p - 1 ? nthreads : cov_threads);
+      chains[c].chain_collection[active[j]].set_dp_slice(dp_slice);
+      chains[c].chain_collection[active[j]].set_single_precision(single_precision);
+    }
+  // with a seed, model i of chain c draws its trees from stream c * p + i;
+  // the models of fully observed columns have no trees
+  if(seed.isNotNull()){
+    uint64_t s = as<long>(seed);
+    for(int c = 0; c < nchains; ++c)
+      for(int j = 0; j < n_active; ++j)
+        chains[c].chain_collection[active[j]].set_seed(s, (uint64_t)c * p + active[j]);
+  }
+  
   Progress progr(nburn + npost, !verbose);
   for (int step = 0; step < nburn + npost; ++step){
     if (Progress::check_abort() )
@@ -145,14 +358,18 @@ List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector t
     
     
     
-    for(int i = 0; i < p; ++i){
-      if(i == p - 1 ){
-        NumericMatrix X_train = row_matrix(X, no_loss_ind);
-        NumericVector y_train = Y[no_loss_ind];
-        
-        chain_collection[i].update_X_Y(clone(X_train), clone(y_train));
-      }else{
-        if(sum(R(_, i + 1)) != 0){
+    for(int c = 0; c < nchains; ++c){
+      std::vector<bmtrees<variant>>& chain_collection = chains[c].chain_collection;
+      NumericMatrix X = chains[c].X;
+      NumericVector Y = chains[c].Y;
+      for(int a = 0; a < n_active; ++a){
+        int i = active[a];
+        if(i == p - 1 ){
+          NumericMatrix X_train = row_matrix(X, no_loss_ind);
+          NumericVector y_train = Y[no_loss_ind];
+          
+          chain_collection[i].update_X_Y(clone(X_train), clone(y_train));
+        }else{
           NumericMatrix X_t = X(_, Range(0,i));
           NumericMatrix X_train = row_matrix(X_t, no_loss_ind);
           NumericVector y_t = X(_, i + 1);
@@ -160,197 +377,81 @@ List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector t
           
           chain_collection[i].update_X_Y(clone(X_train), clone(y_train));
         }
+        chain_collection[i].prepare_tree();
       }
     }
-    if(verbose)
-      Rcout << "single core" << std::endl;
-    for(int i = 0; i < p; ++i){
-      if(i == p - 1 ){
-        if(verbose)
-          Rcout << "fit outcome model" << std::endl;
-        chain_collection[i].update_all(false);
-      }else{
-        if(sum(R(_, i + 1)) != 0){
-          if(verbose)
-            Rcout << "fit model for " << i + 1 + int(!intercept) << "th covariates" << std::endl;
-          chain_collection[i].update_all(false);
-        }
-      }
-    }
-
     if(verbose){
-      Rcout << "Finish model training" << std::endl;
-      Rcout << std::endl;
-      Rcout << "Start imputation:" << std::endl;
-    }
-    NumericMatrix prob_collection_dom_log(n, p);
-    NumericMatrix prob_collection_num_log_expectation(n, p);
-    for(int i = 0 ; i < p ; ++i){
-      if(i == p - 1){
-        NumericVector y_predict_mu = chain_collection[i].predict_expectation(clone(X), clone(Z), clone(subject_id), seqC(1, Y.length()));
-        for(int j = 0; j < n; ++j){
-          if(R(j, i + 1)){
-            prob_collection_dom_log(j, i) = chain_collection[i].predict_probability_log(Y[j], y_predict_mu[j], j);
-            prob_collection_num_log_expectation(j, i) = chain_collection[i].predict_probability_log_expectation(Y[j], y_predict_mu[j]);
-          }
-        }
-        break;
-      }
-      if(sum(R(_, i + 1)) == 0){
-        continue;
-      }
-      NumericMatrix X_train = X(_, Range(0,i));
-      NumericVector y_train = X(_, i + 1);
-      NumericVector y_predict_mu = chain_collection[i].predict_expectation(clone(X_train), clone(Z), clone(subject_id), seqC(1, Y.length()));
-
-      for(int j = 0; j < n; ++j){
-        if(R(j, i + 1)){
-          prob_collection_dom_log(j, i) = chain_collection[i].predict_probability_log(y_train[j], y_predict_mu[j], j);
-          prob_collection_num_log_expectation(j, i) = chain_collection[i].predict_probability_log_expectation(y_train[j], y_predict_mu[j]);
-        }
-      }
-    }
-    // 
-    // 
-    // imputation propose
-    for (int i = 0; i < p - 1; ++i) {
-      if(verbose){
-        std::string blank(30 - as<std::string>(X_names[i+1]).length(), ' ');
-        Rcout << X_names[i+1] << blank;
-      }
-      if(sum(R(_, i + 1)) == 0){
-        if(verbose)
-          Rcout << "No missing data." << std::endl;
-        continue;
-      }
-
-      NumericMatrix prob_collection_num_log(n, p);
-      NumericMatrix prob_collection_dom_log_expectation(n, p);
-      NumericMatrix X_train = X(_, Range(0,i));
-      NumericVector y_train = X(_, i + 1);
-      // sample new value
-      NumericVector new_y_train(Y.length());
-      if(type[i + 1] == 0)
-        new_y_train = chain_collection[i].predict_sample(X_train, Z, subject_id, seqC(1, Y.length()));
+      if(nthreads > 1)
+        Rcout << "fit trees with " << nthreads << " threads" << std::endl;
       else
-        new_y_train = new_y_train + 1;
-      NumericVector y_predict_mu = chain_collection[i].predict_expectation(X_train, Z, subject_id, seqC(1, Y.length()));
-      for(int j = 0; j < n; ++j){
-        prob_collection_num_log(j,i) = chain_collection[i].predict_probability_log(new_y_train[j], y_predict_mu[j], j);
-        prob_collection_dom_log_expectation(j,i) = chain_collection[i].predict_probability_log_expectation(new_y_train[j], y_predict_mu[j]);
-      }
-      for(int j = i + 2; j < p; ++j){
-        if (j >= p){
-          break;
-        }
-        NumericMatrix X_predict;
-        if (j == i + 2){
-          NumericMatrix X_predict_1 = X(_, Range(0, i));
-          X_predict = cbind(X_predict_1, new_y_train);
-        }else{
-          NumericMatrix X_predict_1 = X(_, Range(0, i));
-          NumericMatrix X_predict_2 = X(_, Range(i+2, j-1));
-          X_predict = cbind(X_predict_1, new_y_train, X_predict_2);
-        }
-        NumericVector y_predict_mu = chain_collection[j - 1].predict_expectation(X_predict, Z, subject_id, seqC(1, Y.length()));
-
-
-        for(int k = 0; k < n; ++k){
-          if(R(k, j)){
-            prob_collection_num_log(k, j - 1) = chain_collection[j - 1].predict_probability_log(X(k,j), y_predict_mu[k], k);
-          }
-        }
-      }
-      NumericMatrix X_predict;
-      if (i + 2 < p){
-        NumericMatrix X_predict_1 = X(_, Range(0, i));
-        NumericMatrix X_predict_2 = X(_, Range(i+2, p-1));
-        X_predict = cbind(X_predict_1, new_y_train, X_predict_2);
-      }else{
-        NumericMatrix X_predict_1 = X(_, Range(0, i));
-        X_predict = cbind(X_predict_1, new_y_train);
-      }
-      y_predict_mu = chain_collection[p - 1].predict_expectation(X_predict, Z, subject_id, seqC(1, Y.length()));
-      for(int k = 0; k < n; ++k){
-        if(R(k, p)){
-          prob_collection_num_log(k, p - 1) = chain_collection[p - 1].predict_probability_log(Y[k], y_predict_mu[k], k);
-        }
-      }
-      int missing = 0;
-      int replace = 0;
-      for(int k = 0 ; k < n; ++k){
-        if (R(k, i + 1) == 1){
-          if(type[i + 1] == 0){
-            missing++;
-            NumericVector num_log = prob_collection_num_log(k, _);// Rcpp::Range(i + 1, p - 1));
-            NumericVector dom_log = prob_collection_dom_log(k, _);// Rcpp::Range(i + 1, p - 1));
-            num_log = num_log[Range(i, p - 1)];
-            dom_log = dom_log[Range(i, p - 1)];
-            double log_accept = sum(num_log) - sum(dom_log) + prob_collection_num_log_expectation(k, i) - prob_collection_dom_log_expectation(k, i);// + prob_collection_num_log(k, i) - prob_collection_dom_log(k, i);
-            if(log(runif(1)[0]) < log_accept){
-              replace++;
-              X(k, i + 1) = new_y_train[k];
-            }
-          }else{
-            missing++;
-            NumericVector num_log = prob_collection_num_log(k, _);
-            num_log = exp(num_log[Range(i, p - 1)]);
-            NumericVector zero_num_log = 1 - num_log;
-            double accept_p = sum(num_log) / (sum(num_log) + sum(zero_num_log));
-            int previous = X(k, i + 1);
-            X(k, i + 1) = R::rbinom(1, accept_p);
-            if(previous != X(k, i + 1)){
-              replace++;
-            }
-          }
-        }
-      }
-      double ar = replace;
-      ar = ar / missing;
-      if(verbose)
-        Rcout << "Replace proportion:" << ar << std::endl;
+        Rcout << "single core" << std::endl;
     }
-    if(outcome_is_missing){
-      NumericVector new_y_train = chain_collection[p - 1].predict_sample(X, Z, subject_id, seqC(1, Y.length()));  // this is conditional expectation E(Y|X, Z)
-      //NumericVector y_predict_mu = chain_collection[p - 1].predict_expectation(X, Z, subject_id, seqC(1, Y.length()));
-      //NumericVector prob_collection_dom_log_expectation_y(n);
-      //NumericVector prob_collection_num_log_y(n);
-      int missing = 0;
-      int replace = 0;
-      for(int k = 0 ; k < n; ++k){
-        if (R(k, p) == 1){
-          //prob_collection_num_log_y[k] = chain_collection[p - 1].predict_probability_log(new_y_train[k], y_predict_mu[k], k);
-          //prob_collection_dom_log_expectation_y[k] = chain_collection[p - 1].predict_probability_log_expectation(new_y_train[k], y_predict_mu[k]);
-          missing++;
-          //double num_log_y = prob_collection_num_log_y[k];
-          //double dom_log_y = prob_collection_dom_log(k, p - 1);
-          //double log_accept = 1*(num_log_y - dom_log_y) + prob_collection_num_log_expectation(k, p - 1) - prob_collection_dom_log_expectation_y[k];
-          //if(log(runif(1)[0]) < log_accept){
-          replace++;
-          Y[k] = new_y_train[k];
-          //}
+    // the tree draws only use C++ and their own RNG, so the draws of all models
+    // of all chains can run in parallel; everything that calls R stays on the
+    // main thread
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1) if(cov_threads == 1)
+#endif
+    for(int t = 0; t < n_draws; ++t)
+      chains[t / n_cov].chain_collection[active[t % n_cov]].draw_tree();
+    for(int c = 0; c < nchains; ++c)
+      chains[c].chain_collection[p - 1].draw_tree();
+    
+    for(int c = 0; c < nchains; ++c){
+      imputation_chain<variant>& chain = chains[c];
+      if(verbose && nchains > 1)
+        Rcout << "chain " << c + 1 << std::endl;
+      for(int a = 0; a < n_active; ++a){
+        int i = active[a];
+        if(verbose){
+          if(i == p - 1)
+            Rcout << "fit outcome model" << std::endl;
+          else
+            Rcout << "fit model for " << i + 1 + int(!intercept) << "th covariates" << std::endl;
         }
+        chain.chain_collection[i].collect_tree();
+        chain.chain_collection[i].update_effects(false);
       }
-      double ar = replace;
-      ar = ar / missing;
+      
       if(verbose){
-        std::string blank(23, ' ');
-        Rcout << "OUTCOME" << blank;
-        Rcout << "Replace proportion:" << ar << std::endl;
+        Rcout << "Finish model training" << std::endl;
+        Rcout << std::endl;
+        Rcout << "Start imputation:" << std::endl;
+      }
+      impute_chain(chain, type, Z, subject_id, R, outcome_is_missing, X_names, verbose);
+      if (skip_indicator == skip){
+        chain.imputation_X_DP.push_back(clone(chain.X));
+        chain.imputation_Y_DP.push_back(clone(chain.Y));
       }
     }
     if (skip_indicator == skip){
-      imputation_X_DP.push_back(clone(X));
-      imputation_Y_DP.push_back(clone(Y));
       skip_indicator = 0;
     }
   }
+  
+  // imputations of the chains one after the other
+  for(int c = 0; c < nchains; ++c){
+    for(int k = 0; k < chains[c].imputation_X_DP.length(); ++k){
+      imputation_X_DP.push_back(chains[c].imputation_X_DP[k]);
+      imputation_Y_DP.push_back(chains[c].imputation_Y_DP[k]);
+    }
+  }
 
   return List::create(
     Named("imputation_X_DP")=imputation_X_DP, Named("imputation_Y_DP")=imputation_Y_DP
   );
 }
 
+// [[Rcpp::export]]
+List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector type, NumericMatrix Z, CharacterVector subject_id, LogicalMatrix R, bool binary_outcome = false, int nburn = 0, int npost = 3, int skip = 1, bool verbose = true, bool CDP_residual = false, bool CDP_re = false, Nullable<long> seed = R_NilValue, double tol = 1e-20, int ncores = 0, int ntrees = 200, bool fit_loss = false, int resample = 0, double pi_CDP = 0.99, int nchains = 1, bool dp_slice = false, bool single_precision = false) {
+  if(CDP_residual && CDP_re)
+    return sequential_imputation_run<BMTrees_variant>(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, tol, ncores, ntrees, fit_loss, resample, pi_CDP, nchains, dp_slice, single_precision, seed);
+  if(CDP_residual)
+    return sequential_imputation_run<BMTrees_R_variant>(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, tol, ncores, ntrees, fit_loss, resample, pi_CDP, nchains, dp_slice, single_precision, seed);
+  if(CDP_re)
+    return sequential_imputation_run<BMTrees_RE_variant>(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, tol, ncores, ntrees, fit_loss, resample, pi_CDP, nchains, dp_slice, single_precision, seed);
+  return sequential_imputation_run<mixedBART_variant>(X, Y, type, Z, subject_id, R, binary_outcome, nburn, npost, skip, verbose, tol, ncores, ntrees, fit_loss, resample, pi_CDP, nchains, dp_slice, single_precision, seed);
+}
 
 
 
@@ -358,8 +459,12 @@ List sequential_imputation_cpp(NumericMatrix X, NumericVector Y, LogicalVector t
 
 
 
-// [[Rcpp::export]]
-List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, CharacterVector subject_id, LogicalVector obs_ind, bool binary = false, long nburn = 0, long npost = 3, bool verbose = true, bool CDP_residual = false, bool CDP_re = false, Nullable<long> seed = R_NilValue, double tol = 1e-40, long ntrees = 200, int resample = 0, double pi_CDP = 0.99){
+
+
+// BMTrees_mcmc() for one model variant
+template<class variant> static List BMTrees_mcmc_run(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, CharacterVector subject_id, LogicalVector obs_ind, bool binary, long nburn, long npost, bool verbose, double tol, long ntrees, int resample, double pi_CDP, bool dp_slice, bool single_precision, int ncores, Nullable<long> seed){
+  const bool CDP_residual = variant::CDP_residual;
+  const bool CDP_re = variant::CDP_re;
   NumericMatrix Z_obs;
   NumericMatrix Z_test;
   NumericVector Y_obs = Y[obs_ind];
@@ -372,7 +477,15 @@ List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, C
   
   CharacterVector subject_id_obs = subject_id[obs_ind];
   IntegerVector row_id_obs = seqC(1, Y.length())[obs_ind];
-  bmtrees model = bmtrees(clone(Y_obs), clone(X_obs), clone(Z_obs), subject_id_obs, row_id_obs, binary, CDP_residual, CDP_re, tol, ntrees, resample, pi_CDP);
+  bmtrees<variant> model = bmtrees<variant>(clone(Y_obs), clone(X_obs), clone(Z_obs), subject_id_obs, row_id_obs, binary, tol, ntrees, resample, pi_CDP);
+  model.set_dp_slice(dp_slice);
+  model.set_single_precision(single_precision);
+  // one model and one chain, so all threads go to the rows of each tree draw
+  // and to the DP and random-effect updates
+  model.set_threads(ncores);
+  model.set_tree_threads(ncores);
+  if(seed.isNotNull())
+    model.set_seed(as<long>(seed), 0);
   
   NumericVector Y_test = Y[!obs_ind];
   NumericMatrix X_test = row_matrix(X, !obs_ind);
@@ -434,8 +547,8 @@ List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, C
     
     if(verbose)
       Rcout << i << " " << nburn + npost << std::endl;
-    List post_sample = model.posterior_sampling();
     if(i >= nburn){
+      List post_sample = model.posterior_sampling(false);
       post_tree_pre_mean(i - nburn, 0) = post_sample["tree_pre_mean"];
       post_sigma(i - nburn, 0) = post_sample["sigma"];
       post_x_hat(i - nburn, _) = as<NumericVector>(post_sample["tree_pre"]);
@@ -498,3 +611,14 @@ List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, C
   );
   
 }
+
+// [[Rcpp::export]]
+List BMTrees_mcmc(NumericMatrix X, NumericVector Y, Nullable<NumericMatrix> Z, CharacterVector subject_id, LogicalVector obs_ind, bool binary = false, long nburn = 0, long npost = 3, bool verbose = true, bool CDP_residual = false, bool CDP_re = false, Nullable<long> seed = R_NilValue, double tol = 1e-40, long ntrees = 200, int resample = 0, double pi_CDP = 0.99, bool dp_slice = false, bool single_precision = false, int ncores = 1){
+  if(CDP_residual && CDP_re)
+    return BMTrees_mcmc_run<BMTrees_variant>(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, tol, ntrees, resample, pi_CDP, dp_slice, single_precision, ncores, seed);
+  if(CDP_residual)
+    return BMTrees_mcmc_run<BMTrees_R_variant>(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, tol, ntrees, resample, pi_CDP, dp_slice, single_precision, ncores, seed);
+  if(CDP_re)
+    return BMTrees_mcmc_run<BMTrees_RE_variant>(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, tol, ntrees, resample, pi_CDP, dp_slice, single_precision, ncores, seed);
+  return BMTrees_mcmc_run<mixedBART_variant>(X, Y, Z, subject_id, obs_ind, binary, nburn, npost, verbose, tol, ntrees, resample, pi_CDP, dp_slice, single_precision, ncores, seed);
+}
@@ -0,0 +1,63 @@
+/*
+ *  SBMTrees: Sequential imputation with Bayesian Trees Mixed-Effects models
+ *  Copyright (C) 2024 Jungang Zou
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  https://www.R-project.org/Licenses/GPL-2
+ */
+
+#include <Rcpp.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace Rcpp;
+
+// subjects as integer codes (the row of B given by subject_to_B) with the rows
+// of each subject grouped: the rows of subject s are
+// rows[start[s]], ..., rows[start[s + 1] - 1], in their original order
+struct subject_groups {
+  int n_subject = 0;
+  std::vector<int> code;
+  std::vector<int> start;
+  std::vector<int> rows;
+};
+
+// code of each subject_id in subject_to_B, -1 for subjects not in it
+std::vector<int> encode_subjects(CharacterVector subject_id, const std::unordered_map<std::string, int>& subject_to_B){
+  std::vector<int> code(subject_id.length());
+  for(int i = 0; i < subject_id.length(); ++i){
+    auto it = subject_to_B.find(std::string(subject_id[i]));
+    code[i] = it != subject_to_B.end() ? it->second : -1;
+  }
+  return code;
+}
+
+subject_groups create_subject_groups(CharacterVector subject_id, const std::unordered_map<std::string, int>& subject_to_B){
+  subject_groups g;
+  g.n_subject = subject_to_B.size();
+  g.code = encode_subjects(subject_id, subject_to_B);
+  g.start.assign(g.n_subject + 1, 0);
+  for(int c : g.code)
+    if(c >= 0)
+      ++g.start[c + 1];
+  for(int s = 0; s < g.n_subject; ++s)
+    g.start[s + 1] += g.start[s];
+  g.rows.resize(g.start[g.n_subject]);
+  std::vector<int> next(g.start.begin(), g.start.end() - 1);
+  for(int i = 0; i < (int)g.code.size(); ++i)
+    if(g.code[i] >= 0)
+      g.rows[next[g.code[i]]++] = i;
+  return g;
+}
@@ -33,6 +33,16 @@
 #define UTILS_H_
 #include "utils.h"
 #endif
+
+#ifndef SUBJECT_GROUPS_H_
+#define SUBJECT_GROUPS_H_
+#include "subject_groups.h"
+#endif
+
+#ifndef RE_KERNELS_H_
+#define RE_KERNELS_H_
+#include "re_kernels.h"
+#endif
 #include <cmath>
 #include <iostream>
 #include <unistd.h>
@@ -40,62 +50,97 @@
 using namespace Rcpp;
 using namespace std;
 
-NumericMatrix update_B(NumericVector re, NumericMatrix Z, CharacterVector subject_id, NumericMatrix Mu, std::unordered_map<std::string, int> subject_to_B, NumericMatrix Covariance, double sigma){
-  NumericMatrix B(subject_to_B.size(), Z.ncol());
-                              
-  CharacterVector subject_names = unique(subject_id);
-  //Rcout << "inv_covariance" << std::endl;
-  NumericMatrix inv_covariance = solve_pos_def(Covariance);
-  //Rcout << as<NumericVector>(Mu) << std::endl;
-  //NumericMatrix inv_covariance = solve_pos_def(make_symmetric(make_nonsingular(Covariance)));
-  //NumericMatrix inv_covariance = solve(Covariance);
-  //return inv_covariance;
-  //Rcout << "B" << std::endl;
-  //Rcout << inv_covariance << "  |  ";
-  for(int i = 0; i < subject_names.length(); ++i){
-    //Rcout << i << std::endl;
-    //sleep(1);
-    auto it = subject_to_B.find(std::string(subject_names[i]));
-    if (it != subject_to_B.end()) {
-      String name = subject_names[i];
-      long B_position = (int)(it->second);
-      //return inv_covariance;
-      //std::cout << name << " ";
-      //Rcout << i << " " << B_position << std::endl;
-      CharacterVector subject = {name};
-      LogicalVector index = character_vector_equals(subject_id, subject);
-      //Rcout << index << std::endl;
-      //return inv_covariance;
-      //return List::create(Named("index") = index);
-      NumericMatrix Zi = row_matrix(Z, index);
-      //Rcout << index.length() << std::endl;
-      //Rcout << re.length() << std::endl;
-      //return inv_covariance;
-      NumericVector Ri = re[index];
-      //return List::create(Named("Zi") = Zi, Named("Ri") = Ri);
-      //return inv_covariance;
-      //double alpha_s = alpha[B_position];
-      //Rcout << inv_covariance;
-      NumericMatrix a = matrix_add(inv_covariance, matrix_mul_scalar(matrix_multiply(transpose(Zi), Zi), 1 / pow(sigma, 2)));
-      NumericMatrix var = solve_pos_def(a);
-      
-      NumericVector mui_v = Mu(B_position, _);
-      NumericMatrix mui = NumericMatrix(1, mui_v.length(), mui_v.begin());
-      NumericMatrix ri = NumericMatrix(Ri.length(), 1, Ri.begin());
-      NumericVector mu = wrap(matrix_multiply( matrix_add(matrix_multiply(mui, inv_covariance), transpose(matrix_mul_scalar(matrix_multiply(transpose(Zi), ri), 1/ pow(sigma,2)))), var));
-      
-      //Rcout << mu << " | " << var(0, 0) << " ||| ";
-      
-      NumericVector B_s = wrap(rmvnorm(1, mu, as<arma::mat>(var)));
-      B(B_position, _) = B_s;
-    }else{ 
-      
+// Z_s' Z_s of every subject, d x d column major at ztz[s * d * d]; Z does not
+// change between sweeps, so this is computed once per model
+std::vector<double> subject_crossprod(const NumericMatrix& Z, const subject_groups& groups){
+  int d = Z.ncol();
+  long N = Z.nrow();
+  const double* z = Z.begin();
+  std::vector<double> ztz((size_t)groups.n_subject * d * d, 0.);
+  for(int s = 0; s < groups.n_subject; ++s){
+    double* zs = &ztz[(size_t)s * d * d];
+    for(int k = groups.start[s]; k < groups.start[s + 1]; ++k){
+      int i = groups.rows[k];
+      for(int b = 0; b < d; ++b)
+        for(int a = 0; a < d; ++a)
+          zs[a + b * d] += z[i + a * N] * z[i + b * N];
     }
-    
-    
-  //for(int i = 0; i < 1; ++i){
-    
   }
-  //Rcout <<std::endl;
+  return ztz;
+}
+
+// the draws of update_B for d = D (D = 0: any d), returns the number of
+// subjects whose precision is not positive definite
+template<int D> int update_B_subjects(const double* r, const double* z, long N, const subject_groups& groups, const std::vector<double>& ztz, const double* mu, const double* ic, double sigma2, const double* eps, double* b, int d, int nthreads){
+  const int n = D > 0 ? D : d;
+  const int n_subject = groups.n_subject;
+  int failed = 0;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) reduction(+:failed)
+#endif
+  {
+    re_buffer<D * D> P(n * n);
+    re_buffer<D> m(n), w(n);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for(int s = 0; s < n_subject; ++s){
+      const double* zs = &ztz[(size_t)s * n * n];
+      for(int k = 0; k < n * n; ++k)
+        P.data()[k] = ic[k] + zs[k] / sigma2;
+      for(int a = 0; a < n; ++a){
+        double t = 0;
+        for(int c = 0; c < n; ++c)
+          t += ic[a + c * n] * mu[s + (long)c * n_subject];
+        m.data()[a] = t;
+      }
+      for(int k = groups.start[s]; k < groups.start[s + 1]; ++k){
+        int i = groups.rows[k];
+        for(int a = 0; a < n; ++a)
+          m.data()[a] += z[i + a * N] * r[i] / sigma2;
+      }
+      if(!re_chol<D>(P.data(), d)){
+        ++failed;
+        continue;
+      }
+      // m = P^-1 m, w = L'^-1 eps ~ N(0, P^-1)
+      re_solve_lower<D>(P.data(), m.data(), d);
+      re_solve_upper<D>(P.data(), m.data(), d);
+      for(int a = 0; a < n; ++a)
+        w.data()[a] = eps[(size_t)s * n + a];
+      re_solve_upper<D>(P.data(), w.data(), d);
+      for(int a = 0; a < n; ++a)
+        b[s + (long)a * n_subject] = m.data()[a] + w.data()[a];
+    }
+  }
+  return failed;
+}
+
+// draw B[s, ] | re ~ N(P^-1 (inv_covariance Mu[s, ] + Z_s' re_s / sigma^2), P^-1)
+// with the precision P = inv_covariance + Z_s' Z_s / sigma^2. The standard
+// normals are drawn from R first, then the subjects are solved in parallel
+// with one Cholesky factorization of P each.
+NumericMatrix update_B(const NumericVector& re, const NumericMatrix& Z, const subject_groups& groups, const std::vector<double>& ztz, const NumericMatrix& Mu, const NumericMatrix& Covariance, double sigma, int nthreads = 1){
+  int d = Z.ncol();
+  int n_subject = groups.n_subject;
+  long N = Z.nrow();
+  NumericMatrix B(n_subject, d);
+  arma::mat inv_covariance = inv_sympd(as<arma::mat>(Covariance));
+  double sigma2 = pow(sigma, 2);
+  std::vector<double> eps((size_t)n_subject * d);
+  for(size_t k = 0; k < eps.size(); ++k)
+    eps[k] = R::norm_rand();
+  
+  const double* ic = inv_covariance.memptr();
+  int failed;
+  switch(d){
+  case 1: failed = update_B_subjects<1>(re.begin(), Z.begin(), N, groups, ztz, Mu.begin(), ic, sigma2, eps.data(), B.begin(), d, nthreads); break;
+  case 2: failed = update_B_subjects<2>(re.begin(), Z.begin(), N, groups, ztz, Mu.begin(), ic, sigma2, eps.data(), B.begin(), d, nthreads); break;
+  case 3: failed = update_B_subjects<3>(re.begin(), Z.begin(), N, groups, ztz, Mu.begin(), ic, sigma2, eps.data(), B.begin(), d, nthreads); break;
+  case 4: failed = update_B_subjects<4>(re.begin(), Z.begin(), N, groups, ztz, Mu.begin(), ic, sigma2, eps.data(), B.begin(), d, nthreads); break;
+  default: failed = update_B_subjects<0>(re.begin(), Z.begin(), N, groups, ztz, Mu.begin(), ic, sigma2, eps.data(), B.begin(), d, nthreads); break;
+  }
+  if(failed > 0)
+    stop("update_B: posterior precision of the random effects is not positive definite");
   return B;
-}
\ No newline at end of file
+}
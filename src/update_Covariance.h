@@ -35,22 +35,29 @@
 #define UTILS_H_
 #include "utils.h"
 #endif
+
+#ifndef RE_KERNELS_H_
+#define RE_KERNELS_H_
+#include "re_kernels.h"
+#endif
 #include <cmath>
 
 using namespace Rcpp;
 
 // [[Rcpp::export]]
 NumericMatrix update_Covariance(NumericMatrix B, NumericMatrix Mu, NumericMatrix inverse_wishart_matrix, double df, long N_subject){
-  NumericMatrix B_diff_mu = matrix_add(B, matrix_mul_scalar(Mu, -1));
-  NumericMatrix B_B_A = matrix_multiply(transpose(B_diff_mu), B_diff_mu);
-  //Rcout <<  B_B_A  << std::endl;
-  NumericMatrix Iwish_para = matrix_add(inverse_wishart_matrix, B_B_A);
-  //Rcout << Iwish_para << std::endl;
-  //Rcout <<  arma::chol(as<arma::mat>(Iwish_para)) << std::endl;
+  int d = B.ncol();
+  arma::mat Iwish_para = as<arma::mat>(inverse_wishart_matrix);
+  switch(d){
+  case 1: re_add_crossprod_diff<1>(B.begin(), Mu.begin(), B.nrow(), d, Iwish_para.memptr()); break;
+  case 2: re_add_crossprod_diff<2>(B.begin(), Mu.begin(), B.nrow(), d, Iwish_para.memptr()); break;
+  case 3: re_add_crossprod_diff<3>(B.begin(), Mu.begin(), B.nrow(), d, Iwish_para.memptr()); break;
+  case 4: re_add_crossprod_diff<4>(B.begin(), Mu.begin(), B.nrow(), d, Iwish_para.memptr()); break;
+  default: re_add_crossprod_diff<0>(B.begin(), Mu.begin(), B.nrow(), d, Iwish_para.memptr()); break;
+  }
   //Iwish_para = fix_riwish(Iwish_para);
   //Iwish_para = make_symmetric(Iwish_para);
-  NumericMatrix covariance = wrap(riwishArma(df + N_subject, as<arma::mat>(Iwish_para)));
-  //Rcout << covariance << std::endl;
+  NumericMatrix covariance = wrap(riwishArma(df + N_subject, Iwish_para));
   //return fix_riwish(covariance);
   return covariance;
-}
\ No newline at end of file
+}